@@ -34,9 +34,14 @@ VPATH += ./sources \
 SOURCES += main.cpp \
     MainController.cpp \
     FileInfo.cpp \
+    ImageCache.cpp \
+    ImageBufferPool.cpp \
+    Logger.cpp \
     Settings.cpp \
     Util.cpp \
     MertensCl.cpp \
+    MertensReference.cpp \
+    Validator.cpp \
     gui/MainWindow.cpp \
     gui/ImageElement.cpp \
     gui/QmlPixmapProvider.cpp \
@@ -44,17 +49,24 @@ SOURCES += main.cpp \
     models/FilesModel.cpp \
     models/DevicesModel.cpp \
     models/DeviceInfoModel.cpp \
+    models/PerformanceModel.cpp \
     clew/clew.c \
     wrappersCL/ClPlatform.cpp \
     wrappersCL/ClDevice.cpp \
-    wrappersCL/ClProgram.cpp
+    wrappersCL/ClProgram.cpp \
+    wrappersCL/ClMemory.cpp
 
 HEADERS  += \
     MainController.h \
     FileInfo.h \
+    ImageCache.h \
+    ImageBufferPool.h \
+    Logger.h \
     Settings.h \
     Util.h \
     MertensCl.h \
+    MertensReference.h \
+    Validator.h \
     gui/MainWindow.h \
     gui/ImageElement.h \
     gui/QmlPixmapProvider.h \
@@ -62,10 +74,12 @@ HEADERS  += \
     models/FilesModel.h \
     models/DevicesModel.h \
     models/DeviceInfoModel.h \
+    models/PerformanceModel.h \
     clew/clew.h \
     wrappersCL/ClPlatform.h \
     wrappersCL/ClDevice.h \
-    wrappersCL/ClProgram.h
+    wrappersCL/ClProgram.h \
+    wrappersCL/ClMemory.h
 
 RESOURCES += \
     resources.qrc
@@ -75,6 +89,7 @@ OTHER_FILES += \
     qml/MeasureControl.qml \
     qml/AboutDialog.qml \
     qml/DebugLogDialog.qml \
+    qml/PerformancePanel.qml \
     qml/OefButtonStyle.qml \
     qml/OefMenuBarStyle.qml \
     qml/OefListView.qml \
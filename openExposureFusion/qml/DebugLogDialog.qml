@@ -15,6 +15,8 @@ Window {
     minimumWidth: 500
     minimumHeight: 300
 
+    property int maxLines: 5000
+
     SystemPalette {id: syspal}
 
     ColumnLayout {
@@ -43,7 +45,12 @@ Window {
         }
     }
 
+    // 'str' is a batch of lines, only the latest 'maxLines' are kept
     function append(str){
         textArea.append(str)
+        if(textArea.lineCount > maxLines){
+            var lines = textArea.text.split("\n")
+            textArea.text = lines.slice(lines.length - maxLines).join("\n")
+        }
     }
 }
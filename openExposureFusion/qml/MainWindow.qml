@@ -110,6 +110,7 @@ ApplicationWindow {
 
     property alias filesModel:              table.model
     property alias resultImg:               imgResult.img
+    property alias resultTextureLimit:      imgResult.maxTextureSize
     property alias formatsModel:            cboxOutput.model
     property alias formatsIndex:            cboxOutput.currentIndex
     property alias autoUpdate:              chkAutoUpdateView.checked
@@ -125,9 +126,11 @@ ApplicationWindow {
     property alias statusText:              textStatus.text
     property alias memoryText:              textMemory.text
     property alias memoryProgress:          progressMemory.value
+    property alias performanceModel:        perfPanel.model
 
     onFilesModelChanged: {}
     onResultImgChanged: {}
+    onResultMipmapsChanged: {}
     onFormatsModelChanged: {}
     onFormatsIndexChanged: {}
     onAutoUpdateChanged: {}
@@ -432,6 +435,11 @@ ApplicationWindow {
                             }
                         }
                     }
+
+                    PerformancePanel {
+                        id: perfPanel
+                        Layout.fillWidth: true
+                    }
                 }
             }
         }
@@ -463,4 +471,8 @@ ApplicationWindow {
     function appendDebugStr(str){
         dlgDebug.append(str)
     }
+
+    function setResultImage(img, mipmaps){
+        imgResult.setMipmappedImage(img, mipmaps)
+    }
 }
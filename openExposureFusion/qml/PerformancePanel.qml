@@ -0,0 +1,70 @@
+import QtQuick 2.4
+import QtQuick.Controls 1.2
+import QtQuick.Controls.Styles 1.2
+import QtQuick.Layouts 1.1
+
+GroupBox {
+    id: mainElem
+    title: qsTr("Performance")
+
+    property var model: null
+
+    SystemPalette {id: syspal}
+
+    ColumnLayout {
+        anchors.fill: parent
+
+        TableView {
+            id: tablePerformance
+            model: mainElem.model
+            style: TableViewStyle {}
+            selectionMode: SelectionMode.NoSelection
+            headerVisible: false
+            Layout.fillWidth: true
+            Layout.preferredHeight: 120
+
+            TableViewColumn { role: "propertyname" }
+            TableViewColumn { role: "propertyvalue" }
+        }
+
+        // total time of the recent runs, the latest on the right
+        Canvas {
+            id: chart
+            Layout.fillWidth: true
+            Layout.preferredHeight: 40
+
+            onPaint: {
+                var ctx = getContext("2d")
+                ctx.clearRect(0, 0, width, height)
+                var history = mainElem.model ? mainElem.model.history : []
+                if(history.length < 2)
+                    return
+
+                var maxValue = Math.max.apply(Math, history)
+                if(maxValue <= 0)
+                    return
+
+                ctx.strokeStyle = syspal.highlight
+                ctx.lineWidth = 1
+                ctx.beginPath()
+                for(var i = 0; i < history.length; ++i){
+                    var x = i * (width - 1) / (history.length - 1)
+                    var y = height - 1 - history[i] / maxValue * (height - 2)
+                    if(i === 0) ctx.moveTo(x, y)
+                    else        ctx.lineTo(x, y)
+                }
+                ctx.stroke()
+            }
+            onWidthChanged: requestPaint()
+        }
+    }
+
+    Connections {
+        target: mainElem.model
+        ignoreUnknownSignals: true
+        onHistoryChanged: {
+            tablePerformance.resizeColumnsToContents()
+            chart.requestPaint()
+        }
+    }
+}
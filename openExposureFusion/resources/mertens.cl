@@ -9,10 +9,28 @@ int2 borderCoord(int2 coord, const int2 maxCoord)
 }
 
 #define GRAY (float4)(0.299f, 0.587f, 0.114f, 0.0f)
+/*FM_LumaChroma: BT.601 chroma, luma is GRAY*/
+#define CB (float3)(-0.168736f, -0.331264f, 0.5f)
+#define CR (float3)(0.5f, -0.418688f, -0.081312f)
+
+/*every weight measure is specialized by its exponent: skipped for 0, taken as it is for 1, raised otherwise*/
+#define WEIGHT_OFF 0
+#define WEIGHT_LINEAR 1
+#define WEIGHT_GENERAL 2
+#ifndef CONTRAST_MODE
+#define CONTRAST_MODE WEIGHT_GENERAL
+#endif
+#ifndef SATURATION_MODE
+#define SATURATION_MODE WEIGHT_GENERAL
+#endif
+#ifndef EXPOSEDNESS_MODE
+#define EXPOSEDNESS_MODE WEIGHT_GENERAL
+#endif
 
 kernel void krn_weight(const int2 kernelSize, read_only image2d_t image, write_only image2d_t weightMap,
     const float3 params, const int2 maxCoord)
 /* params: x = contrast, y = saturation, z = exposedness */
+/* EXPOSEDNESS_LUT: 8 bits image, kExposednessLut holds the exposedness term of every channel value */
 /* laplace filter:
     0.0f,    1.0f,    0.0f,
     1.0f,    -4.0f,   1.0f,
@@ -25,24 +43,41 @@ kernel void krn_weight(const int2 kernelSize, read_only image2d_t image, write_o
     const float4 srcColor = read_imagef(image, sampler, coord);
     float3 measures = (float3)(1.0f);
 
+#if CONTRAST_MODE != WEIGHT_OFF
     /*calculate contrast measure - apply laplacian filter on grayscale image*/
     measures.x = fabs(dot(srcColor, GRAY) * -4.0f
         + dot(read_imagef(image, sampler, borderCoord(coord + (int2)(0, -1), maxCoord)), GRAY)
         + dot(read_imagef(image, sampler, borderCoord(coord + (int2)(-1, 0), maxCoord)), GRAY)
         + dot(read_imagef(image, sampler, borderCoord(coord + (int2)(1, 0), maxCoord)), GRAY)
         + dot(read_imagef(image, sampler, borderCoord(coord + (int2)(0, 1), maxCoord)), GRAY));
+#if CONTRAST_MODE == WEIGHT_GENERAL
+    measures.x = pow(measures.x, params.x);
+#endif
+#endif
 
+#if SATURATION_MODE != WEIGHT_OFF
     /*calculate saturation measure - distance between original color and mean color value*/
     measures.y = fast_length(srcColor.xyz - (float3)(dot(srcColor.xyz, (float3)(0.3333333333f))));
+#if SATURATION_MODE == WEIGHT_GENERAL
+    measures.y = pow(measures.y, params.y);
+#endif
+#endif
 
+#if EXPOSEDNESS_MODE != WEIGHT_OFF
     /*calculate exposedness measure*/
+#ifdef EXPOSEDNESS_LUT
+    const int3 index = convert_int3_sat_rte(srcColor.xyz * 255.0f);
+    measures.z = kExposednessLut[index.x] * kExposednessLut[index.y] * kExposednessLut[index.z];
+#else
     float8 tmp;
     tmp.s012 = srcColor.xyz - (float3)(0.5f);
     tmp.s456 = -(tmp.s012 * tmp.s012) * (float3)(12.5f);
     measures.z = tmp.s4 * tmp.s5 * tmp.s6;
-
-    /*apply coefficients*/
-    measures = pow(measures, params);
+#endif
+#if EXPOSEDNESS_MODE == WEIGHT_GENERAL
+    measures.z = pow(measures.z, params.z);
+#endif
+#endif
 
     write_imagef(weightMap, coord, (float4)(measures.x * measures.y * measures.z));
 }
@@ -77,60 +112,225 @@ kernel void krn_div(const int2 kernelSize, read_only image2d_t dividend, read_on
     );
 }
 
-kernel void krn_mul(const int2 kernelSize, read_only image2d_t src1, read_only image2d_t src2, write_only image2d_t dst)
+/* side of the krn_weightStats work group, a power of two; the host sets it to what the device takes */
+#ifndef STATS_GROUP_SIZE
+#define STATS_GROUP_SIZE 16
+#endif
+
+kernel __attribute__((reqd_work_group_size(STATS_GROUP_SIZE, STATS_GROUP_SIZE, 1)))
+void krn_weightStats(const int2 kernelSize, read_only image2d_t weight, read_only image2d_t weightSum,
+    global float2 *stats, const int4 options)
+/* the work items stride over the weights, every group leaves one partial in stats[options.z + group]: */
+/* x => max, y => sum of the normalized weights it covered */
+/* options: xy => weight size, z => index of the frame's first partial in 'stats' */
+{
+    local float2 partials[STATS_GROUP_SIZE * STATS_GROUP_SIZE];
+    float2 result = (float2)(0.0f);
+    for(int y = get_global_id(1); y < options.y; y += get_global_size(1))
+    {
+        for(int x = get_global_id(0); x < options.x; x += get_global_size(0))
+        {
+            const float sum = read_imagef(weightSum, sampler, (int2)(x, y)).x;
+            const float w = (sum > 0.0f) ? min(read_imagef(weight, sampler, (int2)(x, y)).x / sum, 1.0f) : 0.0f;
+            result = (float2)(max(result.x, w), result.y + w);
+        }
+    }
+
+    /* tree reduction of the group, every step halves the partials */
+    const int item = get_local_id(1) * STATS_GROUP_SIZE + get_local_id(0);
+    partials[item] = result;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for(int stride = STATS_GROUP_SIZE * STATS_GROUP_SIZE / 2; stride > 0; stride /= 2)
+    {
+        if(item < stride)
+        {
+            const float2 other = partials[item + stride];
+            partials[item] = (float2)(max(partials[item].x, other.x), partials[item].y + other.y);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if(item == 0)
+        stats[options.z + get_group_id(1) * get_num_groups(0) + get_group_id(0)] = partials[0];
+}
+
+kernel void krn_fill(const int2 kernelSize, const float4 value, write_only image2d_t image)
 {
     const int2 coord = (int2)(get_global_id(0), get_global_id(1));
     if(any(coord >= kernelSize))
         return;
-    write_imagef(dst, coord, read_imagef(src1, sampler, coord) * read_imagef(src2, sampler, coord).xxxx);
+    write_imagef(image, coord, value);
 }
 
-kernel void krn_fill(const int2 kernelSize, const float4 value, write_only image2d_t image)
+kernel void krn_fillBuffer(const int2 kernelSize, const float4 value, global half *buffer, const int channels)
+/* buffer: half rows of kernelSize.x pixels, 'channels' is 1, 2 or 4 */
 {
     const int2 coord = (int2)(get_global_id(0), get_global_id(1));
     if(any(coord >= kernelSize))
         return;
-    write_imagef(image, coord, value);
+    const int offset = coord.y * kernelSize.x + coord.x;
+    switch(channels)
+    {
+        case 1: vstore_half(value.x, offset, buffer); break;
+        case 2: vstore_half2(value.xy, offset, buffer); break;
+        default: vstore_half4(value, offset, buffer); break;
+    }
+}
+
+/*tile-sparse blending: pyramid levels are split in square tiles, a frame blends only the tiles it weighs in*/
+kernel void krn_tileList(const int2 kernelSize, read_only image2d_t weight, global const int4 *rects,
+    global int *tiles, const float threshold)
+/* one work item per tile, kernelSize.x is the tile count */
+/* rects: x, y, width, height of every tile in the atlas, they cover the levels and nothing in between */
+/* tiles: [0] => count of the frame, [1] => listed and [2] => offered over the run, */
+/*        then the indices into 'rects' of the tiles with a weight of 'threshold' or more */
+{
+    const int index = get_global_id(0);
+    if(index >= kernelSize.x)
+        return;
+    if(index == 0)
+        atomic_add(tiles + 2, kernelSize.x);
+    const int4 rect = rects[index];
+    float maxWeight = 0.0f;
+    for(int y = rect.y; (y < rect.y + rect.w) && (maxWeight < threshold); ++y)
+    {
+        for(int x = rect.x; x < rect.x + rect.z; ++x)
+        {
+            maxWeight = max(maxWeight, read_imagef(weight, sampler, (int2)(x, y)).x);
+        }
+    }
+    if(maxWeight >= threshold)
+    {
+        tiles[3 + atomic_inc(tiles)] = index;
+        atomic_inc(tiles + 1);
+    }
+}
+
+kernel void krn_blendTiles(const int2 kernelSize, read_only image2d_t pyr, read_only image2d_t weight,
+    global const int4 *rects, global const int *tiles, global half *sum, const int2 options, const int channels)
+/* one row of work items per tile row, room for every tile, those past the krn_tileList count idle */
+/* options: x => atlas width, y => tile size */
+/* sum: half atlas rows of 'channels' (4, or 1 for luma), every listed pixel adds its 'pyr' value by its weight */
+{
+    const int2 id = (int2)(get_global_id(0), get_global_id(1));
+    if(any(id >= kernelSize))
+        return;
+    const int index = id.y / options.y;
+    if(index >= tiles[0])
+        return;
+    const int4 rect = rects[tiles[3 + index]];
+    const int2 pos = (int2)(id.x, id.y - index * options.y);
+    if(any(pos >= rect.s23))
+        return;
+    const int2 coord = rect.s01 + pos;
+    const int offset = coord.y * options.x + coord.x;
+    const float4 w = read_imagef(weight, sampler, coord).xxxx;
+    if(channels == 1)
+        vstore_half(vload_half(offset, sum) + read_imagef(pyr, sampler, coord).x * w.x, offset, sum);
+    else
+        vstore_half4(vload_half4(offset, sum) + read_imagef(pyr, sampler, coord) * w, offset, sum);
+}
+
+kernel void krn_toLuma(const int2 kernelSize, read_only image2d_t src, write_only image2d_t dst)
+{
+    const int2 coord = (int2)(get_global_id(0), get_global_id(1));
+    if(any(coord >= kernelSize))
+        return;
+    write_imagef(dst, coord, (float4)(dot(read_imagef(src, sampler, coord), GRAY), 0.0f, 0.0f, 1.0f));
+}
+
+kernel void krn_chromaAdd(const int2 kernelSize, read_only image2d_t image, read_only image2d_t weight,
+    global half *sum, const int4 options, const int blockSize)
+/* FM_LumaChroma: the chroma is averaged by the weight level of the same size, no pyramid */
+/* options: xy => 'image' maxCoord, zw => 'weight' level origin in its atlas */
+/* blockSize: 'image' pixels per 'sum' pixel along each axis, they are averaged */
+/* sum: RG half rows of kernelSize.x pixels, Cb and Cr */
+{
+    const int2 coord = (int2)(get_global_id(0), get_global_id(1));
+    if(any(coord >= kernelSize))
+        return;
+    float3 color = (float3)(0.0f);
+    for(int y = 0; y < blockSize; ++y)
+    {
+        for(int x = 0; x < blockSize; ++x)
+        {
+            color += read_imagef(image, sampler, min(coord * (int2)(blockSize) + (int2)(x, y), options.s01)).xyz;
+        }
+    }
+    color *= (float3)(native_recip((float)(blockSize * blockSize)));
+    const int offset = coord.y * kernelSize.x + coord.x;
+    vstore_half2(vload_half2(offset, sum)
+        + (float2)(dot(color, CB), dot(color, CR)) * (float2)(read_imagef(weight, sampler, coord + options.s23).x),
+        offset, sum);
 }
 
-kernel void krn_upsample(const int2 kernelSize, read_only image2d_t small, write_only image2d_t big, const int2 bigMaxCoord)
+kernel void krn_upsample(const int2 kernelSize, read_only image2d_t small, write_only image2d_t big,
+    const int2 bigMaxCoord, const int4 origins)
+/* origins: xy => 'small' level origin in its atlas, zw => 'big' level origin in its atlas */
 {
     const int2 smallCoord = (int2)(get_global_id(0), get_global_id(1));
     if(any(smallCoord >= kernelSize))
         return;
     const int2 bigCoord = smallCoord * (int2)(2,2);
-    write_imagef(big, min(bigCoord + (int2)(1,0), bigMaxCoord), (float4)(0.0f));
-    write_imagef(big, min(bigCoord + (int2)(0,1), bigMaxCoord), (float4)(0.0f));
-    write_imagef(big, min(bigCoord + (int2)(1,1), bigMaxCoord), (float4)(0.0f));
-    write_imagef(big, bigCoord, read_imagef(small, sampler, smallCoord));
+    write_imagef(big, min(bigCoord + (int2)(1,0), bigMaxCoord) + origins.s23, (float4)(0.0f));
+    write_imagef(big, min(bigCoord + (int2)(0,1), bigMaxCoord) + origins.s23, (float4)(0.0f));
+    write_imagef(big, min(bigCoord + (int2)(1,1), bigMaxCoord) + origins.s23, (float4)(0.0f));
+    write_imagef(big, bigCoord + origins.s23, read_imagef(small, sampler, smallCoord + origins.s01));
 }
 
-kernel void krn_toRgba(const int2 kernelSize, read_only image2d_t src, write_only image2d_t dst)
+kernel void krn_toRgba(const int2 kernelSize, read_only image2d_t src, write_only image2d_t dst, const int4 origins)
+/* origins: xy => 'src' level origin in its atlas, zw => 'dst' origin */
 {
     const int2 coord = (int2)(get_global_id(0), get_global_id(1));
     if(any(coord >= kernelSize))
         return;
-    write_imagef(dst, coord, clamp(read_imagef(src, sampler, coord),
+    write_imagef(dst, coord + origins.s23, clamp(read_imagef(src, sampler, coord + origins.s01),
         (float4)(0.0f, 0.0f, 0.0f, 1.0f),
         (float4)(1.0f, 1.0f, 1.0f, 1.0f)));
 }
 
-kernel void krn_copy(const int2 kernelSize, read_only image2d_t src, write_only image2d_t dst)
+kernel void krn_lumaChromaToRgba(const int2 kernelSize, read_only image2d_t src, global const half *chroma,
+    write_only image2d_t dst, const int4 origins, const int2 chromaMaxCoord, const float2 chromaScale)
+/* FM_LumaChroma: krn_toRgba of a luma level, the chroma is interpolated from krn_chromaAdd sums */
+/* origins: xy => 'src' level origin in its atlas, zw => 'dst' origin */
+/* chromaScale: chroma pixels per 'src' pixel */
+{
+    const int2 coord = (int2)(get_global_id(0), get_global_id(1));
+    if(any(coord >= kernelSize))
+        return;
+    const float2 pos = max((convert_float2(coord) + (float2)(0.5f)) * chromaScale - (float2)(0.5f), (float2)(0.0f));
+    const int2 c0 = min(convert_int2(pos), chromaMaxCoord);
+    const int2 c1 = min(c0 + (int2)(1, 1), chromaMaxCoord);
+    const float2 f = clamp(pos - convert_float2(c0), 0.0f, 1.0f);
+    const int row0 = c0.y * (chromaMaxCoord.x + 1);
+    const int row1 = c1.y * (chromaMaxCoord.x + 1);
+    const float2 cbcr = mix(mix(vload_half2(row0 + c0.x, chroma), vload_half2(row0 + c1.x, chroma), f.x),
+                            mix(vload_half2(row1 + c0.x, chroma), vload_half2(row1 + c1.x, chroma), f.x),
+                            f.y);
+    const float y = read_imagef(src, sampler, coord + origins.s01).x;
+    const float3 color = (float3)(y + 1.402f * cbcr.y,
+                                  y - 0.344136f * cbcr.x - 0.714136f * cbcr.y,
+                                  y + 1.772f * cbcr.x);
+    write_imagef(dst, coord + origins.s23, (float4)(clamp(color, 0.0f, 1.0f), 1.0f));
+}
+
+kernel void krn_copy(const int2 kernelSize, read_only image2d_t src, write_only image2d_t dst, const int4 origins)
+/* origins: xy => 'src' origin, zw => 'dst' origin */
 {
     const int2 coord = (int2)(get_global_id(0), get_global_id(1));
     if(any(coord >= kernelSize))
         return;
-    write_imagef(dst, coord, read_imagef(src, sampler, coord));
+    write_imagef(dst, coord + origins.s23, read_imagef(src, sampler, coord + origins.s01));
 }
 
 kernel void krn_filterGauss(const int2 kernelSize, read_only image2d_t src, write_only image2d_t dst,
-    const int8 options, const float4 factor)
+    const int8 options, const float4 factor, const int4 origins)
 /* options:
     01: maxCoord => 'src' size - (1,1)
     23: src coord factor => (1,1) to read all pixels, (2,2) to read even rows/columns only
     45: dst coord factor => (1,1) to write all pixels, (2,2) to write even rows/columns only
     67: direction => (1,0) for horizontal filtering, (0,1) for vertical filtering
 */
+/* origins: xy => 'src' level origin in its atlas, zw => 'dst' level origin in its atlas */
 // gaussian 1D 5: (0.0625) (0.25) (0.375) (0.25) (0.0625)
 // gaussian 1D 7: (0.03125) (0.109375) (0.21875) (0.28125) (0.21875) (0.109375) (0.03125)
 {
@@ -140,16 +340,149 @@ kernel void krn_filterGauss(const int2 kernelSize, read_only image2d_t src, writ
     const int2 srcCoord = coord * options.s23;
     const float4 color =
     // center pixel
-        read_imagef(src, sampler, borderCoord(srcCoord, options.s01)) * (float4)(0.375f)
+        read_imagef(src, sampler, borderCoord(srcCoord, options.s01) + origins.s01) * (float4)(0.375f)
     // direct neighbours
-        + read_imagef(src, sampler, borderCoord(srcCoord + (int2)(1,1) * options.s67, options.s01))
+        + read_imagef(src, sampler, borderCoord(srcCoord + (int2)(1,1) * options.s67, options.s01) + origins.s01)
             * (float4)(0.25f)
-        + read_imagef(src, sampler, borderCoord(srcCoord - (int2)(1,1) * options.s67, options.s01))
+        + read_imagef(src, sampler, borderCoord(srcCoord - (int2)(1,1) * options.s67, options.s01) + origins.s01)
             * (float4)(0.25f)
     // 2nd neighbours
-        + read_imagef(src, sampler, borderCoord(srcCoord + (int2)(2,2) * options.s67, options.s01))
+        + read_imagef(src, sampler, borderCoord(srcCoord + (int2)(2,2) * options.s67, options.s01) + origins.s01)
             * (float4)(0.0625f)
-        + read_imagef(src, sampler, borderCoord(srcCoord - (int2)(2,2) * options.s67, options.s01))
+        + read_imagef(src, sampler, borderCoord(srcCoord - (int2)(2,2) * options.s67, options.s01) + origins.s01)
             * (float4)(0.0625f);
-    write_imagef(dst, coord * options.s45, color * factor);
+    write_imagef(dst, coord * options.s45 + origins.s23, color * factor);
+}
+
+kernel void krn_boxFilter(const int2 kernelSize, read_only image2d_t src, write_only image2d_t dst,
+    const int4 options, const int radius)
+/* options: xy => maxCoord, zw => direction, (1,0) for horizontal filtering, (0,1) for vertical filtering */
+/* mean of the (2 * radius + 1) pixels around every pixel, 'radius' has to be below the image size */
+{
+    const int2 coord = (int2)(get_global_id(0), get_global_id(1));
+    if(any(coord >= kernelSize))
+        return;
+    float4 sum = (float4)(0.0f);
+    for(int i = -radius; i <= radius; ++i)
+    {
+        sum += read_imagef(src, sampler, borderCoord(coord + options.s23 * (int2)(i), options.s01));
+    }
+    write_imagef(dst, coord, sum * (float4)(1.0f / (2 * radius + 1)));
+}
+
+/*guided filter fusion: every frame filters its normalized weight map with its gray image as the guide*/
+kernel void krn_guideStats(const int2 kernelSize, read_only image2d_t image, read_only image2d_t weight,
+    write_only image2d_t dst, const int2 maxCoord, const int radius)
+/* horizontal box means of x => guide, y => weight, z => guide * weight, w => guide * guide */
+{
+    const int2 coord = (int2)(get_global_id(0), get_global_id(1));
+    if(any(coord >= kernelSize))
+        return;
+    float4 sum = (float4)(0.0f);
+    for(int i = -radius; i <= radius; ++i)
+    {
+        const int2 srcCoord = borderCoord(coord + (int2)(i, 0), maxCoord);
+        const float guide = dot(read_imagef(image, sampler, srcCoord), GRAY);
+        const float w = read_imagef(weight, sampler, srcCoord).x;
+        sum += (float4)(guide, w, guide * w, guide * guide);
+    }
+    write_imagef(dst, coord, sum * (float4)(1.0f / (2 * radius + 1)));
+}
+
+kernel void krn_guideCoeffs(const int2 kernelSize, read_only image2d_t stats, write_only image2d_t coeffs,
+    const float eps)
+/* stats: box means of krn_guideStats */
+/* coeffs: x => a, y => b of the local linear model weight = a * guide + b, 'eps' keeps flat areas flat */
+{
+    const int2 coord = (int2)(get_global_id(0), get_global_id(1));
+    if(any(coord >= kernelSize))
+        return;
+    const float4 s = read_imagef(stats, sampler, coord);
+    const float a = (s.z - s.x * s.y) / (max(s.w - s.x * s.x, 0.0f) + eps);
+    write_imagef(coeffs, coord, (float4)(a, s.y - a * s.x, 0.0f, 0.0f));
+}
+
+kernel void krn_guidedAdd(const int2 kernelSize, read_only image2d_t image, read_only image2d_t base,
+    read_only image2d_t coeffs, read_only image2d_t sum, write_only image2d_t dst, const int layer)
+/* layer: 0 => base layer, 1 => detail layer, the frame minus its base layer */
+/* coeffs: box means of krn_guideCoeffs */
+/* sum, dst: xyz => layers weighted by the filtered weight, w => filtered weights */
+{
+    const int2 coord = (int2)(get_global_id(0), get_global_id(1));
+    if(any(coord >= kernelSize))
+        return;
+    const float4 color = read_imagef(image, sampler, coord);
+    const float4 baseColor = read_imagef(base, sampler, coord);
+    const float4 ab = read_imagef(coeffs, sampler, coord);
+    const float w = clamp(ab.x * dot(color, GRAY) + ab.y, 0.0f, 1.0f);
+    const float3 value = layer ? (color.xyz - baseColor.xyz) : baseColor.xyz;
+    write_imagef(dst, coord, read_imagef(sum, sampler, coord) + (float4)(value * (float3)(w), w));
+}
+
+kernel void krn_guidedResult(const int2 kernelSize, read_only image2d_t baseSum, read_only image2d_t detailSum,
+    write_only image2d_t dst)
+/* baseSum, detailSum: sums of krn_guidedAdd, normalized by their weights and added up */
+{
+    const int2 coord = (int2)(get_global_id(0), get_global_id(1));
+    if(any(coord >= kernelSize))
+        return;
+    const float4 base = read_imagef(baseSum, sampler, coord);
+    const float4 detail = read_imagef(detailSum, sampler, coord);
+    const float3 color = base.xyz * (float3)(native_recip(max(base.w, 1e-3f)))
+        + detail.xyz * (float3)(native_recip(max(detail.w, 1e-3f)));
+    write_imagef(dst, coord, (float4)(clamp(color, 0.0f, 1.0f), 1.0f));
+}
+
+/* native layouts of the uploaded frames, have to match MertensCl::NativeLayout */
+#define NL_RGB888   0
+#define NL_BGRA8888 1
+#define NL_RGBA8888 2
+#define NL_RGBA16   3
+#define NL_GRAY8    4
+
+float4 readNative(global const uchar *src, const int layout, const int pitch, const int2 coord)
+{
+    global const uchar *row = src + coord.y * pitch;
+    switch(layout)
+    {
+        case NL_RGB888:
+            return (float4)(convert_float3(vload3(coord.x, row)), 255.0f) * (float4)(1.0f / 255.0f);
+        case NL_BGRA8888:
+            return convert_float4(vload4(coord.x, row)).zyxw * (float4)(1.0f / 255.0f);
+        case NL_RGBA16:
+            return convert_float4(vload4(coord.x, (global const ushort*)row)) * (float4)(1.0f / 65535.0f);
+        case NL_GRAY8:
+            return (float4)((float3)(row[coord.x] * (1.0f / 255.0f)), 1.0f);
+        default:
+            return convert_float4(vload4(coord.x, row)) * (float4)(1.0f / 255.0f);
+    }
+}
+
+kernel void krn_import(const int2 kernelSize, global const uchar *src, write_only image2d_t dst,
+    const int4 layout, const int srcWidth, const float4 mapping)
+/* layout: x => native layout, y => bytes per line, z => first uploaded row, w => number of uploaded rows */
+/* mapping: xy => 'src' pixels per 'dst' pixel, zw => 'dst' origin in the frame */
+/* every 'dst' pixel averages the 'src' pixels it covers, weighted by the covered area */
+{
+    const int2 coord = (int2)(get_global_id(0), get_global_id(1));
+    if(any(coord >= kernelSize))
+        return;
+    const float2 from = (convert_float2(coord) + mapping.zw) * mapping.xy;
+    const float2 to = from + mapping.xy;
+    const int2 first = convert_int2(floor(from));
+    const int2 last = min(convert_int2(ceil(to)) - (int2)(1, 1), (int2)(srcWidth - 1, layout.z + layout.w - 1));
+
+    float4 sum = (float4)(0.0f);
+    float weightSum = 0.0f;
+    for(int y = first.y; y <= last.y; ++y)
+    {
+        const float wy = min(to.y, (float)(y + 1)) - max(from.y, (float)y);
+        for(int x = first.x; x <= last.x; ++x)
+        {
+            const float w = wy * (min(to.x, (float)(x + 1)) - max(from.x, (float)x));
+            sum += readNative(src, layout.x, layout.y, (int2)(x, y - layout.z)) * (float4)(w);
+            weightSum += w;
+        }
+    }
+    write_imagef(dst, coord, sum * (float4)(native_recip(weightSum)));
 }
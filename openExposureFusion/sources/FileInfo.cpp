@@ -17,13 +17,45 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "FileInfo.h"
+#include "ImageCache.h"
+
+const int kThumbnailSize = 256;
 
 FileInfo::FileInfo(const QString filePath)
     : mFilePath(filePath)
+    , mFormat(QImage::Format_Invalid)
 {
-    if(!filePath.isEmpty())
+    if(filePath.isEmpty())
+        return;
+
+    // only the header is read here, pixels are decoded on demand through ImageCache
+    QImageReader reader(filePath);
+    mSize = reader.size();
+    mFormat = reader.imageFormat();
+    const QStringList keys = reader.textKeys();
+    for(int i = 0; i < keys.count(); ++i)
+    {
+        mText[keys.at(i)] = reader.text(keys.at(i));
+    }
+
+    // decoders supporting scaled reads (JPEG) skip most of the work for the thumbnail
+    if(mSize.isValid() && reader.supportsOption(QImageIOHandler::ScaledSize))
+    {
+        reader.setScaledSize(mSize.scaled(kThumbnailSize, kThumbnailSize, Qt::KeepAspectRatio));
+        mThumbnail = reader.read();
+    }
+
+    // the others are decoded in full, which also warms up the cache for the processing
+    if(mThumbnail.isNull())
     {
-        mImg = QImage(filePath);
+        const QImage img = ImageCache::get(filePath);
+        if(!img.isNull())
+        {
+            mSize = img.size();
+            mFormat = img.format();
+            mThumbnail = img.scaled(mSize.scaled(kThumbnailSize, kThumbnailSize, Qt::KeepAspectRatio),
+                                    Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+        }
     }
 }
 
@@ -33,7 +65,12 @@ FileInfo::~FileInfo()
 
 QImage FileInfo::getImage()const
 {
-    return mImg;
+    return ImageCache::get(mFilePath);
+}
+
+QImage FileInfo::getThumbnail()const
+{
+    return mThumbnail;
 }
 
 QString FileInfo::getFilePath()const
@@ -41,7 +78,29 @@ QString FileInfo::getFilePath()const
     return mFilePath;
 }
 
+QSize FileInfo::getSize()const
+{
+    return mSize;
+}
+
+QImage::Format FileInfo::getFormat()const
+{
+    return mFormat;
+}
+
+QMap<QString, QString> FileInfo::getText()const
+{
+    return mText;
+}
+
+bool FileInfo::isHighBitDepth()const
+{
+    // the same rule as MertensCl::isHighBitDepth, gray and packed formats are not 64 bits per pixel
+    const QPixelFormat pixel = QImage::toPixelFormat(mFormat);
+    return std::max({pixel.redSize(), pixel.greenSize(), pixel.blueSize()}) > 8;
+}
+
 bool FileInfo::isValid() const
 {
-    return !mImg.isNull();
+    return !mThumbnail.isNull();
 }
@@ -29,12 +29,20 @@ public:
     ~FileInfo();
 
     QImage getImage()const;
+    QImage getThumbnail()const;
     QString getFilePath()const;
+    QSize getSize()const;
+    QImage::Format getFormat()const;
+    QMap<QString, QString> getText()const;
+    bool isHighBitDepth()const;
     bool isValid()const;
 
 private:
-    QImage mImg;
+    QImage mThumbnail;
     QString mFilePath;
+    QSize mSize;
+    QImage::Format mFormat;
+    QMap<QString, QString> mText; // metadata stored as text by the format, e.g. EXIF description
 };
 
 #endif // FILEINFO_H
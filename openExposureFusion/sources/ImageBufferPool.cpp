@@ -0,0 +1,63 @@
+/*
+openExposureFusion
+Copyright (C) 2015 Alexey Markarov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ImageBufferPool.h"
+
+const int kMaxFreeBuffers = 2;
+
+QMutex ImageBufferPool::sMutex;
+QList<ImageBufferPool::Buffer*> ImageBufferPool::sFree;
+
+QImage ImageBufferPool::create(const QSize size, const QImage::Format format)
+{
+    if(size.isEmpty())
+        return QImage();
+
+    // 32 bits aligned lines, the same as QImage allocates itself
+    const int bytesPerLine = ((size.width() * QImage::toPixelFormat(format).bitsPerPixel() + 31) / 32) * 4;
+    const qint64 bytes = static_cast<qint64>(bytesPerLine) * size.height();
+
+    Buffer *buffer = nullptr;
+    {
+        QMutexLocker lock(&sMutex);
+        for(int i = 0; i < sFree.count(); ++i)
+        {
+            if(sFree.at(i)->bytes == bytes)
+            {
+                buffer = sFree.takeAt(i);
+                break;
+            }
+        }
+    }
+    if(!buffer)
+    {
+        buffer = new Buffer(bytes);
+    }
+
+    return QImage(buffer->data, size.width(), size.height(), bytesPerLine, format, release, buffer);
+}
+
+void ImageBufferPool::release(void *info)
+{
+    QMutexLocker lock(&sMutex);
+    sFree.prepend(static_cast<Buffer*>(info));
+    while(sFree.count() > kMaxFreeBuffers)
+    {
+        delete sFree.takeLast();
+    }
+}
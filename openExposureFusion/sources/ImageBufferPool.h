@@ -0,0 +1,50 @@
+/*
+openExposureFusion
+Copyright (C) 2015 Alexey Markarov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGEBUFFERPOOL_H
+#define IMAGEBUFFERPOOL_H
+
+#include <QtCore>
+#include <QtGui>
+
+// recycles pixel buffers of the images handed out, a buffer returns to the pool with its last QImage copy
+class ImageBufferPool
+{
+public:
+    static QImage create(const QSize size, const QImage::Format format);
+
+private:
+    class Buffer
+    {
+    public:
+        uchar *data;
+        qint64 bytes;
+
+        Buffer(const qint64 b) : data(new uchar[b]), bytes(b) { }
+        ~Buffer() { delete[] data; }
+    };
+
+    static QMutex sMutex;
+    static QList<Buffer*> sFree;
+
+    static void release(void *info);
+    ImageBufferPool();
+    ~ImageBufferPool();
+};
+
+#endif // IMAGEBUFFERPOOL_H
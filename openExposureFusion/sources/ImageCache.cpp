@@ -0,0 +1,59 @@
+/*
+openExposureFusion
+Copyright (C) 2015 Alexey Markarov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ImageCache.h"
+
+QMutex ImageCache::sMutex;
+QCache<QString, QImage> ImageCache::sCache;
+
+QImage ImageCache::get(const QString filePath)
+{
+    {
+        QMutexLocker lock(&sMutex);
+        const QImage *img = sCache.object(filePath);
+        if(img)
+            return *img;
+    }
+
+    // decode without holding the lock, so other files can be served meanwhile
+    const QImage img(filePath);
+    if(img.isNull())
+        return img;
+
+    QMutexLocker lock(&sMutex);
+    sCache.insert(filePath, new QImage(img), std::max<qint64>(1, img.sizeInBytes() / 1024));
+    return img;
+}
+
+void ImageCache::remove(const QString filePath)
+{
+    QMutexLocker lock(&sMutex);
+    sCache.remove(filePath);
+}
+
+void ImageCache::setMaxBytes(const qint64 bytes)
+{
+    QMutexLocker lock(&sMutex);
+    sCache.setMaxCost(std::min<qint64>(bytes / 1024, std::numeric_limits<int>::max()));
+}
+
+qint64 ImageCache::getMaxBytes()
+{
+    QMutexLocker lock(&sMutex);
+    return static_cast<qint64>(sCache.maxCost()) * 1024;
+}
@@ -0,0 +1,41 @@
+/*
+openExposureFusion
+Copyright (C) 2015 Alexey Markarov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include <QtCore>
+#include <QtGui>
+
+// process-wide LRU cache of decoded images, images are decoded on the first request
+class ImageCache
+{
+public:
+    static QImage get(const QString filePath);
+    static void remove(const QString filePath);
+    static void setMaxBytes(const qint64 bytes);
+    static qint64 getMaxBytes();
+
+private:
+    static QMutex sMutex;
+    static QCache<QString, QImage> sCache; // costs are in KiB to stay within int
+    ImageCache();
+    ~ImageCache();
+};
+
+#endif // IMAGECACHE_H
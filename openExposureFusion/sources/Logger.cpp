@@ -0,0 +1,180 @@
+/*
+openExposureFusion
+Copyright (C) 2015 Alexey Markarov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Logger.h"
+
+const QString kDateTimeFormat("yyyy/MM/dd-HH:mm:ss.zzz");
+const int kIdleMsec = 20;          // drain period while nothing is queued
+const int kMaxPendingLines = 1000; // kept until the UI takes them
+
+Logger::Entry Logger::sRing[Logger::kRingSize];
+QAtomicInteger<quint32> Logger::sWritePos;
+quint32 Logger::sReadPos = 0;
+QAtomicInteger<quint32> Logger::sDropped;
+QAtomicPointer<QObject> Logger::sSink;
+const char *Logger::sSinkMethod = nullptr;
+QStringList Logger::sPending;
+Logger::DrainThread Logger::sThread;
+QtMessageHandler Logger::sPreviousHandler = nullptr;
+
+void Logger::start()
+{
+    for(int i = 0; i < kRingSize; ++i)
+    {
+        sRing[i].sequence.store(i);
+    }
+    sWritePos.store(0);
+    sReadPos = 0;
+    sThread.start(QThread::LowestPriority);
+    sPreviousHandler = qInstallMessageHandler(messageHandler);
+}
+
+void Logger::stop()
+{
+    // nothing drains the ring once the thread is gone, later messages go to the previous handler;
+    // the thread's last drain writes what was queued before that
+    qInstallMessageHandler(sPreviousHandler);
+    sPreviousHandler = nullptr;
+    sSink.store(nullptr);
+    sThread.requestInterruption();
+    sThread.wait();
+}
+
+void Logger::setSink(QObject *receiver, const char *method)
+{
+    sSinkMethod = method;
+    sSink.storeRelease(receiver);
+}
+
+void Logger::messageHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg)
+{
+    Q_UNUSED(context)
+
+    // the application aborts right after a fatal message, so it can't wait for the drain
+    if(type == QtFatalMsg)
+    {
+        const QString line = format(type, QDateTime::currentMSecsSinceEpoch(), msg);
+        fprintf(stderr, "%s\n", line.toLocal8Bit().constData());
+        fflush(stderr);
+        return;
+    }
+
+    if(!push(type, msg))
+        sDropped.fetchAndAddRelaxed(1);
+}
+
+bool Logger::push(const QtMsgType type, const QString text)
+{
+    // bounded multi-producer ring: a slot is claimed by moving the write position past it,
+    // and published by advancing its sequence
+    quint32 pos = sWritePos.load();
+    Entry *entry = nullptr;
+    for(;;)
+    {
+        entry = &sRing[pos & (kRingSize - 1)];
+        const qint32 diff = static_cast<qint32>(entry->sequence.loadAcquire() - pos);
+        if(diff == 0)
+        {
+            if(sWritePos.testAndSetRelaxed(pos, pos + 1))
+                break;
+            pos = sWritePos.load();
+        }
+        else if(diff < 0)
+        {
+            return false; // full
+        }
+        else
+        {
+            pos = sWritePos.load();
+        }
+    }
+
+    entry->type = type;
+    entry->time = QDateTime::currentMSecsSinceEpoch();
+    entry->text = text;
+    entry->sequence.storeRelease(pos + 1);
+    return true;
+}
+
+bool Logger::drain()
+{
+    QStringList lines;
+    for(;;)
+    {
+        Entry &entry = sRing[sReadPos & (kRingSize - 1)];
+        if(static_cast<qint32>(entry.sequence.loadAcquire() - (sReadPos + 1)) < 0)
+            break;
+        lines.append(format(entry.type, entry.time, entry.text));
+        entry.text.clear();
+        entry.sequence.storeRelease(sReadPos + kRingSize);
+        ++sReadPos;
+    }
+
+    const quint32 dropped = sDropped.fetchAndStoreRelaxed(0);
+    if(dropped > 0)
+    {
+        lines.append(format(QtWarningMsg, QDateTime::currentMSecsSinceEpoch(),
+                            QString("%1 log messages dropped").arg(dropped)));
+    }
+    if(lines.isEmpty())
+        return false;
+
+    for(int i = 0; i < lines.count(); ++i)
+    {
+        fprintf(stderr, "%s\n", lines.at(i).toLocal8Bit().constData());
+    }
+    fflush(stderr);
+
+    // the UI gets whole batches, lines drained before it exists are kept up to a limit
+    sPending.append(lines);
+    if(sPending.count() > kMaxPendingLines)
+        sPending.erase(sPending.begin(), sPending.begin() + (sPending.count() - kMaxPendingLines));
+    QObject *sink = sSink.loadAcquire();
+    if(sink)
+    {
+        QMetaObject::invokeMethod(sink, sSinkMethod, Qt::QueuedConnection, Q_ARG(const QStringList, sPending));
+        sPending.clear();
+    }
+    return true;
+}
+
+QString Logger::format(const QtMsgType type, const qint64 time, const QString text)
+{
+    static const QMap<QtMsgType, QString> typeMap = {
+        {QtDebugMsg,    "Debug"},
+        {QtWarningMsg,  "Warning"},
+        {QtCriticalMsg, "Critical"},
+        {QtFatalMsg,    "Fatal"},
+    };
+
+    return QDateTime::fromMSecsSinceEpoch(time, Qt::UTC).toString(kDateTimeFormat)
+           + " "
+           + typeMap.value(type, "Msg")
+           + ": "
+           + text;
+}
+
+void Logger::DrainThread::run()
+{
+    while(!isInterruptionRequested())
+    {
+        if(!drain())
+            msleep(kIdleMsec);
+    }
+    drain();
+}
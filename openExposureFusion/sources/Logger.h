@@ -0,0 +1,75 @@
+/*
+openExposureFusion
+Copyright (C) 2015 Alexey Markarov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <QtCore>
+
+// per item engine messages, compiled out of release builds
+#ifdef QT_NO_DEBUG
+#define verboseDebug QT_NO_QDEBUG_MACRO
+#else
+#define verboseDebug qDebug
+#endif
+
+// message handler that only queues messages, a background thread formats and writes them;
+// producers never block, messages are dropped while the ring is full; installed from start() to stop()
+class Logger
+{
+public:
+    static void start();
+    static void stop();
+    static void setSink(QObject *receiver, const char *method); // invoked with batches of lines, as QStringList
+    static void messageHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg);
+
+private:
+    class Entry
+    {
+    public:
+        QAtomicInteger<quint32> sequence; // ring position the entry is free or filled for
+        QtMsgType type;
+        qint64 time;
+        QString text;
+    };
+
+    class DrainThread : public QThread
+    {
+    protected:
+        virtual void run();
+    };
+
+    static const int kRingSize = 4096; // power of two
+    static Entry sRing[kRingSize];
+    static QAtomicInteger<quint32> sWritePos;
+    static quint32 sReadPos;                // drain thread only
+    static QAtomicInteger<quint32> sDropped;
+    static QAtomicPointer<QObject> sSink;
+    static const char *sSinkMethod;
+    static QStringList sPending;            // lines drained before a sink is set
+    static DrainThread sThread;
+    static QtMessageHandler sPreviousHandler;
+
+    static bool push(const QtMsgType type, const QString text);
+    static bool drain();
+    static QString format(const QtMsgType type, const qint64 time, const QString text);
+    Logger();
+    ~Logger();
+};
+
+#endif // LOGGER_H
@@ -23,6 +23,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "wrappersCL/ClPlatform.h"
 #include "MertensCl.h"
 #include "Util.h"
+#include "ImageCache.h"
+#include "Logger.h"
+#include "wrappersCL/ClMemory.h"
 
 const QMap<Settings::Type, MainWindow::PropertyType> kMapOptionToProperty = {
     {Settings::T_AutoUpdateView,        MainWindow::PT_AutoUpdate},
@@ -33,59 +36,16 @@ const QMap<Settings::Type, MainWindow::PropertyType> kMapOptionToProperty = {
 };
 
 const QString kTimeFormat("HH:mm:ss.zzz");
-const QString kDateTimeFormat("yyyy/MM/dd-HH:mm:ss.zzz");
-
-MainController *MainController::sCtrl = nullptr;
-QMutex MainController::sDebugMutex;
-QStringList MainController::sDebugQueue;
-
-void MainController::debugMessageHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg)
-{
-    Q_UNUSED(context)
-
-    QMutexLocker lock(&sDebugMutex);
-
-    static const QMap<QtMsgType, QString> typeMap = {
-        {QtDebugMsg,    "Debug"},
-        {QtWarningMsg,  "Warning"},
-        {QtCriticalMsg, "Critical"},
-        {QtFatalMsg,    "Fatal"},
-    };
-
-    const QString finalMsg = QDateTime::currentDateTimeUtc().toString(kDateTimeFormat)
-                             + " "
-                             + typeMap.value(type, "Msg")
-                             + ": "
-                             + msg;
-    fprintf(stderr, "%s\n", finalMsg.toLocal8Bit().data());
-    bool flushed = false;
-    if(sCtrl)
-    {
-        if(sCtrl->mWnd)
-        {
-            for(int i = 0; i < sDebugQueue.count(); ++i)
-            {
-                sCtrl->mWnd->appendDebugStr(sDebugQueue.at(i));
-            }
-            sCtrl->mWnd->appendDebugStr(finalMsg);
-            flushed = true;
-        }
-    }
-
-    if(!flushed)
-    {
-        sDebugQueue.append(finalMsg);
-    }
-}
+const int kProcessingDelay = 150; // msec, a burst of changes settles into a single processing
 
 MainController::MainController(QObject *parent)
     : QObject(parent)
     , mWnd(nullptr)
     , mScheduleUpdate(false)
     , mProcessingTimerId(-1)
+    , mDelayedProcessingTimerId(-1)
     , mIsProcessing(false)
 {
-    sCtrl = this;
 }
 
 MainController::~MainController()
@@ -150,7 +110,7 @@ bool MainController::init()
 
 void MainController::initQt()
 {
-    qInstallMessageHandler(debugMessageHandler);
+    Logger::start();
 
     qApp->setOrganizationName("openExposureFusion");
     qApp->setApplicationName("openExposureFusion");
@@ -164,16 +124,22 @@ void MainController::initQt()
     qmlRegisterType<QmlHelper>("QmlHelper", 1, 0, "QmlHelper");
 
     qRegisterMetaType<QList<QImage>>("QList<QImage>");
+    qRegisterMetaType<QVector<QImage>>("QVector<QImage>");
+    qRegisterMetaType<cl_context>("cl_context");
+    qRegisterMetaType<cl_device_id>("cl_device_id");
     qRegisterMetaType<MertensCl::Parameters>("MertensCl::Parameters");
+    qRegisterMetaType<MertensCl::Statistics>("MertensCl::Statistics");
 }
 
 void MainController::initUi()
 {
     mWnd = new MainWindow(this);
+    Logger::setSink(this, "onLogMessages");
     mWnd->setProperty(MainWindow::PT_OutputFormatModel,     QVariant::fromValue(mFileFormatsModel));
     mWnd->setProperty(MainWindow::PT_InputFilesModel,       QVariant::fromValue(&mInputFilesModel));
     mWnd->setProperty(MainWindow::PT_DevicesModel,          QVariant::fromValue(&mDevicesModel));
     mWnd->setProperty(MainWindow::PT_DevicesPropertyModel,  QVariant::fromValue(&mDeviceInfoModel));
+    mWnd->setProperty(MainWindow::PT_PerformanceModel,      QVariant::fromValue(&mPerformanceModel));
     mWnd->setProperty(MainWindow::PT_Title,                 qApp->applicationDisplayName());
 }
 
@@ -231,10 +197,11 @@ void MainController::connectSignals()
     connect(mWnd, SIGNAL(saveClicked()),                                SLOT(onSaveClicked()));
     connect(mWnd, SIGNAL(updateViewClicked()),                          SLOT(onUpdateViewClicked()));
 
-    connect(&mExpoFusion, SIGNAL(finished(QImage)), SLOT(onFinished(QImage)));
+    connect(&mExpoFusion, SIGNAL(finished(QImage,QVector<QImage>)), SLOT(onFinished(QImage,QVector<QImage>)));
+    connect(&mExpoFusion, SIGNAL(statisticsChanged(MertensCl::Statistics)),
+            &mPerformanceModel, SLOT(addRun(MertensCl::Statistics)));
 
-    connect(&mInputFilesModel, SIGNAL(rowsInserted(QModelIndex,int,int)),   SLOT(onInputListChanged()));
-    connect(&mInputFilesModel, SIGNAL(rowsRemoved(QModelIndex,int,int)),    SLOT(onInputListChanged()));
+    connect(&mInputFilesModel, SIGNAL(filesChanged()), SLOT(onInputListChanged()));
 }
 
 void MainController::release()
@@ -244,6 +211,12 @@ void MainController::release()
     {
         mThreadForCore.terminate();
     }
+    Logger::stop();
+}
+
+void MainController::onLogMessages(const QStringList lines)
+{
+    mWnd->appendDebugStr(lines.join("\n"));
 }
 
 void MainController::loadSettings()
@@ -268,6 +241,9 @@ void MainController::loadSettings()
                     mWnd->setProperty(MainWindow::PT_OutputFormatIndex, qMax(0, index));
                     break;
                 }
+                case Settings::T_ImageCacheSize:
+                    ImageCache::setMaxBytes(value.toLongLong() * 1024 * 1024);
+                    break;
                 default: break;
             }
         }
@@ -287,6 +263,7 @@ void MainController::onPropertyChanged(const MainWindow::PropertyType type)
     {
         case MainWindow::PT_OutputFormatIndex:
             Settings::set(Settings::T_OutputFormat, mFileFormatsModel.at(wndValue.toInt()));
+            updateMemoryUsage();
             break;
 
         case MainWindow::PT_DevicesIndex:
@@ -304,22 +281,24 @@ void MainController::onPropertyChanged(const MainWindow::PropertyType type)
         MainWindow::PT_MeasureContrast,
         MainWindow::PT_MeasureExposedness,
         MainWindow::PT_MeasureSaturation,
-        MainWindow::PT_DevicesIndex
+        MainWindow::PT_DevicesIndex,
+        MainWindow::PT_OutputFormatIndex
     };
     if(updateTriggers.contains(type))
     {
         if(mWnd->getProperty(MainWindow::PT_AutoUpdate).toBool())
         {
-            processImages();
+            processImagesDelayed();
         }
     }
 }
 
-void MainController::onFinished(const QImage result)
+void MainController::onFinished(const QImage result, const QVector<QImage> mipmaps)
 {
     mIsProcessing = false;
-    mWnd->setProperty(MainWindow::PT_ResultImage, result);
+    mWnd->setResultImage(result, mipmaps);
     mWnd->setProperty(MainWindow::PT_Progress, 0);
+    updateMemoryUsage();
 
     killTimer(mProcessingTimerId);
     mProcessingTimerId = -1;
@@ -344,9 +323,22 @@ void MainController::processImages()
     params.contrast = mWnd->getProperty(MainWindow::PT_MeasureContrast).toFloat();
     params.saturation = mWnd->getProperty(MainWindow::PT_MeasureSaturation).toFloat();
     params.exposedness = mWnd->getProperty(MainWindow::PT_MeasureExposedness).toFloat();
-
-    mExpoFusion.setCl(mDeviceInfoModel.getDevice().getContext(), mDeviceInfoModel.getDevice().getId());
-    mExpoFusion.setParameters(params);
+    params.highBitDepth = isHighBitDepthOutput();
+    // the viewer scales results bigger than a texture by itself otherwise
+    params.mipmapsAbove = mWnd->getProperty(MainWindow::PT_ResultTextureLimit).toInt();
+    params.maxPyrHeight = maxPyrHeight();
+    params.hostPyrLevels = Settings::get(Settings::T_HostPyramidLevels,
+                                         Settings::getDefault(Settings::T_HostPyramidLevels)).toInt();
+    params.fusion = fusionMode();
+    params.pruneThreshold = Settings::get(Settings::T_PruneThreshold,
+                                          Settings::getDefault(Settings::T_PruneThreshold)).toFloat();
+    params.weightLevel = weightLevel();
+
+    // mExpoFusion lives on the core thread, queued calls keep its state away from a running process
+    QMetaObject::invokeMethod(&mExpoFusion, "setCl",
+                              Q_ARG(const cl_context, mDeviceInfoModel.getDevice().getContext()),
+                              Q_ARG(const cl_device_id, mDeviceInfoModel.getDevice().getId()));
+    QMetaObject::invokeMethod(&mExpoFusion, "setParameters", Q_ARG(const MertensCl::Parameters, params));
     QMetaObject::invokeMethod(&mExpoFusion, "process");
 
     mProcessingTime.restart();
@@ -359,19 +351,29 @@ void MainController::processImages()
     qDebug() << "processing start" << QTime::currentTime().toString(kTimeFormat);
 }
 
+void MainController::processImagesDelayed()
+{
+    // every new request restarts the delay
+    if(mDelayedProcessingTimerId >= 0)
+    {
+        killTimer(mDelayedProcessingTimerId);
+    }
+    mDelayedProcessingTimerId = startTimer(kProcessingDelay);
+}
+
 void MainController::onInputListChanged()
 {
     const QList<FileInfo> infos = mInputFilesModel.getFiles();
-    QList<QImage> images;
+    QStringList files;
     for(int i = 0; i < infos.count(); ++i)
     {
-        images.append(infos.at(i).getImage());
+        files.append(infos.at(i).getFilePath());
     }
-    QMetaObject::invokeMethod(&mExpoFusion, "setImages", Q_ARG(const QList<QImage>, images));
+    QMetaObject::invokeMethod(&mExpoFusion, "setFiles", Q_ARG(const QStringList, files));
 
     if(mWnd->getProperty(MainWindow::PT_AutoUpdate).toBool())
     {
-        processImages();
+        processImagesDelayed();
     }
     updateMemoryUsage();
 }
@@ -431,6 +433,12 @@ void MainController::timerEvent(QTimerEvent *event)
     {
         mWnd->setProperty(MainWindow::PT_StatusText, QTime(0,0).addMSecs(mProcessingTime.elapsed()).toString(kTimeFormat));
     }
+    else if(event->timerId() == mDelayedProcessingTimerId)
+    {
+        killTimer(mDelayedProcessingTimerId);
+        mDelayedProcessingTimerId = -1;
+        processImages();
+    }
 }
 
 void MainController::updateMemoryUsage()
@@ -443,13 +451,77 @@ void MainController::updateMemoryUsage()
     }
     else
     {
+        const QMap<MertensCl::Strategy, QString> strategies = {
+            {MertensCl::S_Incremental,  tr("incremental")},
+            {MertensCl::S_Resident,     tr("all frames resident")},
+            {MertensCl::S_Streaming,    tr("streaming frames")},
+            {MertensCl::S_Tiled,        tr("tiled")}
+        };
         const QList<FileInfo> files = mInputFilesModel.getFiles();
-        const qint64 processMem = MertensCl::calcMemoryFootprint(files.first().getImage().size(),
-                                                                 files.count());
+        const bool highBitDepth = isHighBitDepthOutput();
+        // the frames are fused at the size they all have, as far as the device takes it
+        QVector<QSize> sizes;
+        for(int i = 0; i < files.count(); ++i)
+        {
+            sizes.append(files.at(i).getSize());
+        }
+        const QSize frameSize = MertensCl::calcFrameSize(sizes, mDeviceInfoModel.getDevice().getId());
+        const MertensCl::ExecutionPlan plan = MertensCl::planExecution(frameSize,
+                                                                       files.count(),
+                                                                       mDeviceInfoModel.getDevice().getId(),
+                                                                       highBitDepth,
+                                                                       fusionMode(),
+                                                                       weightLevel(),
+                                                                       maxPyrHeight());
+        // what is allocated is shown once there is anything, the planned footprint until then
+        const qint64 allocatedMem = ClMemory::getBytes();
+        const qint64 processMem = (allocatedMem > 0)
+                ? allocatedMem
+                : plan.isValid()
+                  ? plan.bytes
+                  : MertensCl::calcMemoryFootprint(frameSize, files.count(), highBitDepth,
+                                                   false, fusionMode(), weightLevel());
         const double percent = (double)processMem / deviceMem;
         mWnd->setProperty(MainWindow::PT_MemoryProgress, percent * 100);
-        mWnd->setProperty(MainWindow::PT_MemoryText, tr("%1 of %2")
+        mWnd->setProperty(MainWindow::PT_MemoryText, tr("%1%2 of %3 (%4)")
+                          .arg((allocatedMem > 0) ? QString() : tr("~"))
                           .arg(Util::toHumanText(processMem))
-                          .arg(Util::toHumanText(deviceMem)));
+                          .arg(Util::toHumanText(deviceMem))
+                          .arg(strategies.value(plan.strategy, tr("doesn't fit"))));
+    }
+}
+
+bool MainController::isHighBitDepthOutput()const
+{
+    // keep 16 bits only when there is something to keep and the output format can store it
+    static const QStringList highBitDepthFormats = {"png", "tif", "tiff"};
+    const QString format = mFileFormatsModel.value(mWnd->getProperty(MainWindow::PT_OutputFormatIndex).toInt());
+    if(!highBitDepthFormats.contains(format))
+        return false;
+
+    const QList<FileInfo> infos = mInputFilesModel.getFiles();
+    for(int i = 0; i < infos.count(); ++i)
+    {
+        if(infos.at(i).isHighBitDepth())
+            return true;
     }
+    return false;
+}
+
+MertensCl::FusionMode MainController::fusionMode()const
+{
+    const int mode = Settings::get(Settings::T_FusionMode, Settings::getDefault(Settings::T_FusionMode)).toInt();
+    return ((mode > MertensCl::FM_Pyramid) && (mode < MertensCl::FM_max))
+            ? static_cast<MertensCl::FusionMode>(mode)
+            : MertensCl::FM_Pyramid;
+}
+
+int MainController::maxPyrHeight()const
+{
+    return Settings::get(Settings::T_PyramidMaxHeight, Settings::getDefault(Settings::T_PyramidMaxHeight)).toInt();
+}
+
+int MainController::weightLevel()const
+{
+    return Settings::get(Settings::T_WeightLevel, Settings::getDefault(Settings::T_WeightLevel)).toInt();
 }
@@ -23,6 +23,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "models/FilesModel.h"
 #include "models/DevicesModel.h"
 #include "models/DeviceInfoModel.h"
+#include "models/PerformanceModel.h"
 #include "gui/MainWindow.h"
 #include "wrappersCL/ClPlatform.h"
 #include "MertensCl.h"
@@ -43,26 +44,24 @@ protected:
 
 private slots:
     void onPropertyChanged(const MainWindow::PropertyType type);
-    void onFinished(const QImage result);
+    void onFinished(const QImage result, const QVector<QImage> mipmaps);
     void onInputListChanged();
     void onSaveClicked();
     void onUpdateViewClicked();
+    void onLogMessages(const QStringList lines);
 
 private:
-    static void debugMessageHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg);
-    static MainController *sCtrl;
-    static QMutex sDebugMutex;
-    static QStringList sDebugQueue;
-
     MainWindow *mWnd;
     QStringList mFileFormatsModel;
     FilesModel mInputFilesModel;
     DevicesModel mDevicesModel;
     MertensCl mExpoFusion;
     DeviceInfoModel mDeviceInfoModel;
+    PerformanceModel mPerformanceModel;
     bool mScheduleUpdate;
     QTime mProcessingTime;
     int mProcessingTimerId;
+    int mDelayedProcessingTimerId;
     bool mIsProcessing;
 
     QThread mThreadForCore;
@@ -76,8 +75,13 @@ private:
 
     void loadSettings();
     void processImages();
+    void processImagesDelayed();
     void updateDeviceWarning();
     void updateMemoryUsage();
+    bool isHighBitDepthOutput()const;
+    MertensCl::FusionMode fusionMode()const;
+    int maxPyrHeight()const;
+    int weightLevel()const;
 };
 
 #endif // MAINCONTROLLER_H
@@ -31,6 +31,11 @@ OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "MertensCl.h"
 #include "wrappersCL/ClProgram.h"
 #include "Util.h"
+#include "wrappersCL/ClMemory.h"
+#include "MertensReference.h"
+#include "Logger.h"
+#include "ImageCache.h"
+#include "ImageBufferPool.h"
 #include <QtConcurrent>
 #include <functional>
 
@@ -42,10 +47,36 @@ OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
     return returnValue; \
     }
 
+const double kDeviceMemoryBudget = 0.9; // part of the global memory left for the driver and other applications
+const int kGaussRadius = 2;         // krn_filterGauss taps on either side
+// tiled runs blend this many levels at most; a level reaches 2^level * kGaussRadius rows, deeper pyramids would need
+// strips overlapping by most of the frame, so tiled results differ from the others by the levels below the cap
+const int kTiledMaxPyrHeight = 7;
+const int kWeightParamsArg = 3; // krn_weight(kernelSize, image, weightMap, params, maxCoord)
+const QByteArray kBuildOptions("-cl-fast-relaxed-math -cl-mad-enable");
+
+// FM_GuidedFilter, the two-scale fusion of Li, Kang and Hu, "Image Fusion with Guided Filtering"
+const int kGuidedBaseRadius = 15;           // mean filter splitting a frame into its base and detail layers
+const int kGuidedBaseWeightRadius = 45;     // the base layer takes smooth weights
+const float kGuidedBaseWeightEps = 0.3f;
+const int kGuidedDetailWeightRadius = 7;    // the detail layer follows the edges of the frame
+const float kGuidedDetailWeightEps = 1e-6f;
+const int kGuidedTileOverlap = kGuidedBaseWeightRadius * 2; // reach of the filtered base weights
+
+// work groups per side of krn_weightStats, each leaves one partial max and sum of a frame's weights
+const int kWeightStatsGroups = 8;
+
+// reduced weights, every level saves 4x of the weight stage; coarser ones would smear the weights over the edges
+const int kMaxWeightLevel = 2;
+
 const cl_image_format kFormatRUnormInt8     = {CL_R,    CL_UNORM_INT8};
 const cl_image_format kFormatRgbaUnormInt8  = {CL_RGBA, CL_UNORM_INT8};
+const cl_image_format kFormatRgbaUnormInt16 = {CL_RGBA, CL_UNORM_INT16};
+const cl_image_format kFormatRgb32          = {(Q_BYTE_ORDER == Q_LITTLE_ENDIAN) ? CL_BGRA : CL_ARGB, CL_UNORM_INT8};
 const cl_image_format kFormatRHalf          = {CL_R,    CL_HALF_FLOAT};
+const cl_image_format kFormatRgHalf         = {CL_RG,   CL_HALF_FLOAT};
 const cl_image_format kFormatRgbaHalf       = {CL_RGBA, CL_HALF_FLOAT};
+const cl_image_format kFormatRgbaFloat      = {CL_RGBA, CL_FLOAT};
 
 const QMap<MertensCl::ProcessingImage, cl_image_format> MertensCl::sFormatsMap = {
     {MertensCl::PI_Result,      kFormatRgbaUnormInt8},
@@ -53,109 +84,268 @@ const QMap<MertensCl::ProcessingImage, cl_image_format> MertensCl::sFormatsMap =
     {MertensCl::PI_WeightSum,   kFormatRHalf}
 };
 
-qint64 MertensCl::calcMemoryFootprint(const QSize imgSize, const int imgCount)
+// the filter images subtract close means, so they keep full precision
+const QMap<MertensCl::GuidedImage, cl_image_format> MertensCl::sGuidedFormatsMap = {
+    {MertensCl::GI_Base,        kFormatRgbaHalf},
+    {MertensCl::GI_Filter1,     kFormatRgbaFloat},
+    {MertensCl::GI_Filter2,     kFormatRgbaFloat},
+    {MertensCl::GI_BaseSum,     kFormatRgbaHalf},
+    {MertensCl::GI_DetailSum,   kFormatRgbaHalf},
+    {MertensCl::GI_SumTmp,      kFormatRgbaHalf}
+};
+
+// tile-sparse blending, a frame leaves the tiles where its weight pyramid stays below Parameters::blendTileWeight
+const int MertensCl::sBlendTileSize = 16;
+
+bool MertensCl::isHighBitDepth(const QList<QImage> images)
+{
+    for(int i = 0; i < images.count(); ++i)
+    {
+        if(isHighBitDepth(images.at(i).format()))
+            return true;
+    }
+    return false;
+}
+
+bool MertensCl::isHighBitDepth(const QImage::Format format)
+{
+    // any channel wider than 8 bits, gray and packed formats are not 64 bits per pixel
+    const QPixelFormat pixel = QImage::toPixelFormat(format);
+    return std::max({pixel.redSize(), pixel.greenSize(), pixel.blueSize()}) > 8;
+}
+
+qint64 MertensCl::calcMemoryFootprint(const QSize imgSize, const int imgCount, const bool highBitDepth,
+                                      const bool framePyramids, const FusionMode fusion, const int weightLevel)
 {
+    const cl_image_format rgbaFormat = highBitDepth ? kFormatRgbaUnormInt16 : kFormatRgbaUnormInt8;
     qint64 bytes = 0;
 
     // mMemSrcImages
-    bytes += Util::byteCount(imgSize, kFormatRgbaUnormInt8) * imgCount;
+    bytes += Util::byteCount(imgSize, rgbaFormat) * imgCount;
 
-    // mMemProcessingImgs
+    // mMemStaging, native frames are about the size of the processed ones
+    bytes += Util::byteCount(imgSize, rgbaFormat);
+
+    // mMemProcessingImgs, the weight sums are as big as the weights
+    const int level = calcWeightLevel(weightLevel, fusion, calcPyrHeight(imgSize));
+    const QSize weightSize = calcPyrLevels(imgSize, level + 1).last().size();
     for(int i = 0; i < PI_max; ++i)
     {
         const ProcessingImage type = static_cast<ProcessingImage>(i);
-        bytes += Util::byteCount(imgSize, sFormatsMap.value(type));
+        const bool isWeight = (type == PI_WeightSum) || (type == PI_TmpRHalf);
+        bytes += Util::byteCount(isWeight ? weightSize : imgSize,
+                                 (type == PI_Result) ? rgbaFormat : sFormatsMap.value(type));
     }
 
-    // mMemWeights
-    bytes += Util::byteCount(imgSize, kFormatRHalf) * imgCount;
+    // mMemWeights, and mMemWeightSource
+    bytes += Util::byteCount(weightSize, kFormatRHalf) * imgCount;
+    if(level > 0)
+        bytes += Util::byteCount(weightSize, kFormatRgbaHalf);
 
-    // pyramids
-    const int pyrHeight = calcPyrHeight(imgSize);
-    QSize tmpSize = imgSize;
-    for(int i = 0; i < pyrHeight; ++i)
+    // mMemGuidedImgs, instead of any pyramid
+    if(fusion == FM_GuidedFilter)
     {
-        // mMemResultPyramid
-        bytes += Util::byteCount(tmpSize, kFormatRgbaHalf);
-        // mMemWeightPyramid
-        bytes += Util::byteCount(tmpSize, kFormatRgbaHalf);
-        // mMemImagePyramid
-        bytes += Util::byteCount(tmpSize, kFormatRgbaHalf);
-        // mMemPyrRgbaHalf1
-        bytes += Util::byteCount(tmpSize, kFormatRgbaHalf);
-        // mMemPyrRgbaHalf2
-        bytes += Util::byteCount(tmpSize, kFormatRgbaHalf);
-        tmpSize /= 2;
+        for(int i = 0; i < GI_max; ++i)
+        {
+            bytes += Util::byteCount(imgSize, sGuidedFormatsMap.value(static_cast<GuidedImage>(i)));
+        }
+        return bytes;
     }
 
+    // mMemPyramids, and mMemBlendSum
+    const QVector<QRect> levels = calcPyrLevels(imgSize, calcPyrHeight(imgSize));
+    const QSize atlasSize = calcAtlasSize(levels);
+    bytes += Util::byteCount(atlasSize, pyrFormat(fusion)) * (PA_max + 1);
+
+    // mMemChromaSum
+    if((fusion == FM_LumaChroma) && !levels.isEmpty())
+        bytes += Util::byteCount(levels.at(std::min(1, levels.count() - 1)).size(), kFormatRgHalf);
+
+    // mMemFramePyramids
+    if(framePyramids)
+        bytes += Util::byteCount(atlasSize, pyrFormat(fusion)) * imgCount;
+
     return bytes;
 }
 
+MertensCl::ExecutionPlan MertensCl::planExecution(const QSize imgSize, const int imgCount,
+                                                  const cl_device_id device, const bool highBitDepth,
+                                                  const FusionMode fusion, const int weightLevel,
+                                                  const int maxPyrHeight, const Strategy first)
+{
+    if(imgSize.isEmpty() || (imgCount <= 0))
+        return ExecutionPlan();
+
+    const qint64 budget = ClDevice::getDeviceGlobalMemory(device) * kDeviceMemoryBudget;
+    const qint64 maxAlloc = ClDevice::getDeviceMaxMemAllocSize(device);
+    const int pyrHeight = calcPyrHeight(imgSize, maxPyrHeight);
+    // every strip keeps the depth of the whole frame, the overlap covers the reach of its deepest level
+    const int tiledHeight = calcPyrHeight(imgSize, (maxPyrHeight > 0)
+                                                   ? std::min(maxPyrHeight, kTiledMaxPyrHeight)
+                                                   : kTiledMaxPyrHeight);
+    const int align = calcStripAlignment(fusion, tiledHeight);
+    const int overlap = (fusion == FM_GuidedFilter) ? kGuidedTileOverlap : (kGaussRadius << tiledHeight) + align;
+    qint64 bytes = 0;
+
+    for(int i = first; i < S_max; ++i)
+    {
+        const Strategy strategy = static_cast<Strategy>(i);
+        switch(strategy)
+        {
+            case S_Incremental:
+                // the guided filter has no frame pyramids to keep
+                if((fusion != FM_GuidedFilter)
+                   && fitsDevice(imgSize, imgCount, highBitDepth, true, fusion, weightLevel, budget, maxAlloc, bytes))
+                    return ExecutionPlan(strategy, imgSize, imgSize, 0, pyrHeight, bytes);
+                break;
+
+            case S_Resident:
+                if(fitsDevice(imgSize, imgCount, highBitDepth, false, fusion, weightLevel, budget, maxAlloc, bytes))
+                    return ExecutionPlan(strategy, imgSize, imgSize, 0, pyrHeight, bytes);
+                break;
+
+            case S_Streaming:
+                if(fitsDevice(imgSize, 1, highBitDepth, false, fusion, weightLevel, budget, maxAlloc, bytes))
+                    return ExecutionPlan(strategy, imgSize, imgSize, 0, pyrHeight, bytes);
+                break;
+
+            case S_Tiled:
+                // halve the strips until they fit, each strip also carries the overlap with both neighbours;
+                // strips whose core is thinner than the overlap can't hold the deepest level, there is no plan then
+                for(int h = imgSize.height() / 2; h >= overlap * 2; h /= 2)
+                {
+                    // the last strip ends at the frame border, its start has to stay aligned as well
+                    const int passHeight = std::min(h + overlap * 2, imgSize.height());
+                    const QSize passSize(imgSize.width(), passHeight + (imgSize.height() - passHeight) % align);
+                    if(fitsDevice(passSize, 1, highBitDepth, false, fusion, weightLevel, budget, maxAlloc, bytes))
+                        return ExecutionPlan(strategy, imgSize, passSize, overlap, tiledHeight, bytes);
+                }
+                break;
+
+            default: break;
+        }
+    }
+
+    return ExecutionPlan();
+}
+
+bool MertensCl::fitsDevice(const QSize passSize, const int residentCount, const bool highBitDepth,
+                           const bool framePyramids, const FusionMode fusion, const int weightLevel,
+                           const qint64 budget, const qint64 maxAlloc, qint64 &bytes)
+{
+    // atlases are the biggest single allocations, or the guided filter images without them
+    const qint64 maxBytes = (fusion == FM_GuidedFilter)
+            ? Util::byteCount(passSize, kFormatRgbaFloat)
+            : Util::byteCount(calcAtlasSize(calcPyrLevels(passSize, calcPyrHeight(passSize))), pyrFormat(fusion));
+    bytes = calcMemoryFootprint(passSize, residentCount, highBitDepth, framePyramids, fusion, weightLevel);
+    return (bytes <= budget) && (maxBytes <= maxAlloc);
+}
+
 template<typename Arg>
-cl_int MertensCl::setKernelArg(const cl_kernel kernel, const int argIndex, const Arg arg)
+void MertensCl::packArgs(QVector<QByteArray> &blocks, const Arg arg)
 {
-    const cl_int err = kernel ? clSetKernelArg(kernel, argIndex, sizeof(Arg), &arg) : CL_INVALID_KERNEL;
-    MERTENSCL_ASSERT(err, QString("error setting kernel arg %1").arg(argIndex), err);
-    return err;
+    blocks.append(QByteArray(reinterpret_cast<const char*>(&arg), sizeof(Arg)));
+}
+
+template<typename Arg, typename ... Args>
+void MertensCl::packArgs(QVector<QByteArray> &blocks, const Arg arg, const Args ... args)
+{
+    packArgs(blocks, arg);
+    packArgs(blocks, args...);
+}
+
+template<typename Arg>
+void MertensCl::collectMems(QVector<cl_mem> &, const Arg)
+{
+}
+
+void MertensCl::collectMems(QVector<cl_mem> &mems, const cl_mem mem)
+{
+    mems.append(mem);
 }
 
 template<typename Arg, typename ... Args>
-cl_int MertensCl::setKernelArg(const cl_kernel kernel, const int argIndex, const Arg arg, const Args ... args)
+void MertensCl::collectMems(QVector<cl_mem> &mems, const Arg arg, const Args ... args)
 {
-    const cl_int err = setKernelArg(kernel, argIndex, arg);
-    MERTENSCL_ASSERT(err, "kernel arg error", err);
-    return setKernelArg(kernel, argIndex + 1, args...);
+    collectMems(mems, arg);
+    collectMems(mems, args...);
 }
 
 template<typename Arg, typename ... Args>
-cl_int MertensCl::enqueueKernel(const Runtime runtime, const MertensCl::KernelType type, const QSize size,
+cl_int MertensCl::enqueueKernel(const Runtime &runtime, const MertensCl::KernelType type, const QSize size,
                                 const Arg arg, const Args ... args)
 {
-    static const QMetaEnum ktEnum = staticMetaObject.enumerator(staticMetaObject.indexOfEnumerator("KernelType"));
-    const KernelInfo info = runtime.kernels.value(type);
-    const QString kernelName = ktEnum.valueToKey(type);
+    return enqueueKernel(runtime, type, QRect(QPoint(0, 0), size), arg, args...);
+}
 
-    const cl_int2 kernelSize = {size.width(), size.height()};
-    cl_int err = info.kernel ? clSetKernelArg(info.kernel, 0, sizeof(cl_int2), &kernelSize) : CL_INVALID_KERNEL;
-    MERTENSCL_ASSERT(err, "error setting kernel size arg", err);
+template<typename Arg, typename ... Args>
+cl_int MertensCl::enqueueKernel(const Runtime &runtime, const MertensCl::KernelType type, const QRect region,
+                                const Arg arg, const Args ... args)
+{
+    const QMap<KernelType, KernelInfo>::const_iterator it = runtime.kernels.constFind(type);
+    if(it == runtime.kernels.constEnd())
+        return CL_INVALID_KERNEL;
+    const KernelInfo &info = it.value();
+    const QSize size = region.size();
 
-    err = setKernelArg(info.kernel, 1, arg, args...);
-    MERTENSCL_ASSERT(err, "error setting args of kernel " + kernelName, err);
+    Dispatch dispatch(Dispatch::DT_Kernel, info.name, mStage);
+    dispatch.kernelType = type;
+    dispatch.kernel = info.kernel;
 
-    size_t localSize[2];
-    localSize[0] = std::min<size_t>(size.width(), info.preferredSize > 0 ? info.preferredSize : mMaxLocalGroupSizeSqrt);
-    const size_t h = info.preferredSize > 0 ? info.preferredSize : mMaxLocalGroupSizeSqrt;
-    localSize[1] = std::min<size_t>(size.height(),
-                                    h * h <= mMaxLocalGroupSize ? h : mMaxLocalGroupSize / localSize[0]);
+    // the global offset moves the work items onto the region, so kernels see the region's far corner as their size
+    const cl_int2 kernelSize = {region.x() + region.width(), region.y() + region.height()};
+    packArgs(dispatch.args, kernelSize, arg, args...);
 
-    const size_t globalSize[2] = {Util::addPadding(size.width(), localSize[0]),
-                                  Util::addPadding(size.height(), localSize[1])};
-#ifdef PROFILING
-    qDebug() << kernelName << size << "global" << globalSize[0] << globalSize[1] << "local" << localSize[0] << localSize[1];
-#endif
+    if(!info.compileSize.isEmpty())
+    {
+        // reductions in local memory depend on the group size they were written for
+        dispatch.local[0] = info.compileSize.width();
+        dispatch.local[1] = info.compileSize.height();
+    }
+    else
+    {
+        dispatch.local[0] = std::min<size_t>(size.width(),
+                                             info.preferredSize > 0 ? info.preferredSize : mMaxLocalGroupSizeSqrt);
+        const size_t h = info.preferredSize > 0 ? info.preferredSize : mMaxLocalGroupSizeSqrt;
+        dispatch.local[1] = std::min<size_t>(size.height(),
+                                             h * h <= mMaxLocalGroupSize ? h : mMaxLocalGroupSize / dispatch.local[0]);
+    }
 
+    dispatch.offset[0] = region.x();
+    dispatch.offset[1] = region.y();
+    dispatch.range[0] = Util::addPadding(size.width(), dispatch.local[0]);
+    dispatch.range[1] = Util::addPadding(size.height(), dispatch.local[1]);
 #ifdef PROFILING
-    cl_event event;
+    qDebug() << info.name << region << "global" << dispatch.range[0] << dispatch.range[1]
+             << "local" << dispatch.local[0] << dispatch.local[1];
 #endif
-    err = clEnqueueNDRangeKernel(runtime.queue, info.kernel, 2, nullptr, globalSize, localSize, 0, nullptr,
-                             #ifdef PROFILING
-                                 &event
-                             #else
-                                 nullptr
-                             #endif
-                                 );
-    MERTENSCL_ASSERT(err, "unable to execute kernel " + kernelName, err);
 
-#ifdef PROFILING
-    mProfile.append({event, kernelName});
-#endif
-    return err;
+    // all kernels write their last memory argument and only read the others
+    collectMems(dispatch.reads, arg, args...);
+    if(!dispatch.reads.isEmpty())
+        dispatch.writes.append(dispatch.reads.takeLast());
+
+    return enqueue(runtime, dispatch);
 }
 
 MertensCl::MertensCl()
     : mContext(0),
       mDevice(0),
-      mParams({1,1,0})
+      mFrameFormat(QImage::Format_Invalid),
+      mMemStaging(0),
+      mWeightLevel(0),
+      mMemWeightSource(0),
+      mPyrChannels(4),
+      mMemWeightStats(0),
+      mMemBlendSum(0),
+      mMemBlendTiles(0),
+      mBlendTileCounts(3),
+      mMemBlendTileRects(0),
+      mMemChromaSum(0),
+      mChromaLevel(0),
+      mKeptFrameFormat(QImage::Format_Invalid),
+      mRecording(nullptr),
+      mStage(ST_max)
 {
 }
 
@@ -194,31 +384,62 @@ void MertensCl::setCl(const cl_context context, const cl_device_id device)
         mContext = context;
         mDevice = device;
         clearProcessingData();
+        releaseKeptFrames();
     }
 }
 
-void MertensCl::setImages(const QList<QImage> images)
+void MertensCl::setFiles(const QStringList files)
 {
-    mImages = images;
+    keepFrames(files);
+    mFiles = files;
     clearProcessingData();
 }
 
 void MertensCl::setParameters(const MertensCl::Parameters params)
 {
+    // the result image changes its format, everything else is reallocated along with it; so is the plan
+    if((params.highBitDepth != mParams.highBitDepth)
+       || (params.firstStrategy != mParams.firstStrategy))
+    {
+        releaseDeviceData();
+    }
+    // the pyramid geometry or the blending changes, so do the images of the kept frames
+    if((params.maxPyrHeight != mParams.maxPyrHeight)
+       || (params.hostPyrLevels != mParams.hostPyrLevels)
+       || (params.fusion != mParams.fusion)
+       || (params.weightLevel != mParams.weightLevel))
+    {
+        releaseKeptFrames();
+        releaseDeviceData();
+    }
+    // the recorded weights measure the frames only while pruning is on, the recorded tile lists take the threshold
+    if(((params.pruneThreshold > 0.0f) != (mParams.pruneThreshold > 0.0f))
+       || (params.blendTileWeight != mParams.blendTileWeight))
+    {
+        mDispatchPlan.clear();
+    }
+    if((params.contrast != mParams.contrast)
+       || (params.saturation != mParams.saturation)
+       || (params.exposedness != mParams.exposedness))
+    {
+        invalidateWeights();
+    }
     mParams = params;
 }
 
 QImage MertensCl::process()
 {
     const QImage result = assertAndProcess();
-    emit finished(result);
+    emit finished(result, mResultMipmaps);
+    if(!result.isNull())
+        emit statisticsChanged(mStatistics);
     return result;
 }
 
-QImage MertensCl::process(const cl_context context, const cl_device_id device, const QList<QImage> sourceImages, const MertensCl::Parameters params)
+QImage MertensCl::process(const cl_context context, const cl_device_id device, const QStringList files, const MertensCl::Parameters params)
 {
     setCl(context, device);
-    setImages(sourceImages);
+    setFiles(files);
     setParameters(params);
     return process();
 }
@@ -236,7 +457,7 @@ MertensCl::Runtime MertensCl::compile(const cl_context context, const cl_device_
         return Runtime();
     }
 
-    if(!buildProgram(program, device))
+    if(!buildProgram(program, device, deviceOptions(device)))
     {
         qDebug() << "unable to build the program";
         return Runtime();
@@ -260,17 +481,18 @@ MertensCl::Runtime MertensCl::compile(const cl_context context, const cl_device_
     return Runtime(program, queue, kernels);
 }
 
-cl_program MertensCl::createProgram(const cl_context context)
+cl_program MertensCl::createProgram(const cl_context context, const QByteArray prefix)
 {
     static const QString sourceFilePath(":/mertens.cl");
 
     QFile file(sourceFilePath);
-    const QByteArray sources = file.open(QFile::ReadOnly) ? file.readAll() : QByteArray();
+    const QByteArray fileSources = file.open(QFile::ReadOnly) ? file.readAll() : QByteArray();
     file.close();
 
-    qDebug() << "source code length" << sources.length();
-    if(sources.isEmpty())
+    qDebug() << "source code length" << fileSources.length() << "prefix length" << prefix.length();
+    if(fileSources.isEmpty())
         return 0;
+    const QByteArray sources = prefix + fileSources;
 
     cl_int errorCode = CL_SUCCESS;
 
@@ -282,9 +504,10 @@ cl_program MertensCl::createProgram(const cl_context context)
     return program;
 }
 
-bool MertensCl::buildProgram(const cl_program program, const cl_device_id device)
+bool MertensCl::buildProgram(const cl_program program, const cl_device_id device, const QByteArray options)
 {
-    const cl_int buildResult = clBuildProgram(program, 1, &device, nullptr, nullptr, nullptr);
+    qDebug() << "build options" << options;
+    const cl_int buildResult = clBuildProgram(program, 1, &device, options.constData(), nullptr, nullptr);
     const cl_build_status buildStatus = ClProgram::getProgramBuildStatus(program, device);
     const QStringList buildLog = ClProgram::getProgramBuildLog(program, device);
 
@@ -297,149 +520,286 @@ bool MertensCl::buildProgram(const cl_program program, const cl_device_id device
 
 QMap<MertensCl::KernelType, MertensCl::KernelInfo> MertensCl::createKernels(const cl_program program,
                                                                             const cl_device_id device)
+{
+    QMap<KernelType, KernelInfo> kernels;
+    for(int i = 0; i < KT_max; ++i)
+    {
+        const KernelType type = static_cast<KernelType>(i);
+        const KernelInfo info = createKernel(program, device, type);
+        if(info.kernel)
+            kernels[type] = info;
+    }
+
+    return kernels;
+}
+
+MertensCl::KernelInfo MertensCl::createKernel(const cl_program program, const cl_device_id device,
+                                              const KernelType type)
 {
     static const QMap<KernelType, QByteArray> kernelNames = {
         {KT_Weight,         "krn_weight"},
         {KT_Add,            "krn_add"},
         {KT_Sub,            "krn_sub"},
         {KT_Div,            "krn_div"},
-        {KT_Mul,            "krn_mul"},
         {KT_Fill,           "krn_fill"},
         {KT_Upsample,       "krn_upsample"},
         {KT_ToRgba,         "krn_toRgba"},
         {KT_Copy,           "krn_copy"},
-        {KT_FilterGauss,    "krn_filterGauss"}
+        {KT_FilterGauss,    "krn_filterGauss"},
+        {KT_Import,         "krn_import"},
+        {KT_BoxFilter,      "krn_boxFilter"},
+        {KT_GuideStats,     "krn_guideStats"},
+        {KT_GuideCoeffs,    "krn_guideCoeffs"},
+        {KT_GuidedAdd,      "krn_guidedAdd"},
+        {KT_GuidedResult,   "krn_guidedResult"},
+        {KT_WeightStats,    "krn_weightStats"},
+        {KT_FillBuffer,     "krn_fillBuffer"},
+        {KT_TileList,       "krn_tileList"},
+        {KT_BlendTiles,     "krn_blendTiles"},
+        {KT_ToLuma,         "krn_toLuma"},
+        {KT_ChromaAdd,      "krn_chromaAdd"},
+        {KT_LumaChromaToRgba, "krn_lumaChromaToRgba"}
     };
 
-    QMap<KernelType, KernelInfo> kernels;
     cl_int errorCode;
 
-    for(int i = 0; i < KT_max; ++i)
+    const QByteArray name = kernelNames.value(type);
+    verboseDebug() << "creating kernel" << type << name;
+    if(name.isEmpty())
     {
-        const KernelType type = static_cast<KernelType>(i);
-        const QByteArray name = kernelNames.value(type);
-        qDebug() << "creating kernel" << type << name;
-        if(name.isEmpty())
-        {
-            qDebug() << "unknown kernel, name is missing";
-            continue;
-        }
-        const cl_kernel kernel = clCreateKernel(program, name.constData(), &errorCode);
-        qDebug() << "created kernel" << kernel << "error" << errorCode << Util::toString(errorCode);
-        if(!kernel || errorCode != CL_SUCCESS)
-        {
-            qDebug() << "clCreateKernel failed";
-            continue;
-        }
+        qDebug() << "unknown kernel, name is missing";
+        return KernelInfo();
+    }
+    const cl_kernel kernel = clCreateKernel(program, name.constData(), &errorCode);
+    verboseDebug() << "created kernel" << kernel << "error" << errorCode << Util::toString(errorCode);
+    if(!kernel || errorCode != CL_SUCCESS)
+    {
+        qDebug() << "clCreateKernel failed";
+        return KernelInfo();
+    }
 
-        size_t workSize;
-        errorCode = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
-                                             sizeof(size_t), &workSize, nullptr);
-        if(errorCode != CL_SUCCESS)
-        {
-            qDebug() << "CL_KERNEL_WORK_GROUP_SIZE failed";
-            workSize = 0;
-        }
+    size_t workSize;
+    errorCode = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+                                         sizeof(size_t), &workSize, nullptr);
+    if(errorCode != CL_SUCCESS)
+    {
+        qDebug() << "CL_KERNEL_WORK_GROUP_SIZE failed";
+        workSize = 0;
+    }
 
-        size_t preferredSize;
-        errorCode = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
-                                                     sizeof(size_t), &preferredSize, nullptr);
-        if(errorCode != CL_SUCCESS)
-        {
-            qDebug() << "CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE failed";
-            preferredSize = 0;
-        }
+    size_t preferredSize;
+    errorCode = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+                                         sizeof(size_t), &preferredSize, nullptr);
+    if(errorCode != CL_SUCCESS)
+    {
+        qDebug() << "CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE failed";
+        preferredSize = 0;
+    }
 
-        kernels[type] = KernelInfo(kernel, workSize, preferredSize);
+    size_t compileSize[3];
+    errorCode = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE,
+                                         sizeof(compileSize), compileSize, nullptr);
+    if(errorCode != CL_SUCCESS)
+    {
+        qDebug() << "CL_KERNEL_COMPILE_WORK_GROUP_SIZE failed";
+        compileSize[0] = compileSize[1] = 0;
     }
 
-    return kernels;
+    const QSize compiled(static_cast<int>(compileSize[0]), static_cast<int>(compileSize[1]));
+    return KernelInfo(kernel, workSize, preferredSize, compiled, QString::fromLatin1(name));
+}
+
+MertensCl::WeightTerm MertensCl::weightTerm(const float exponent)
+{
+    if(exponent == 0.0f)
+        return WT_Off;
+    return (exponent == 1.0f) ? WT_Linear : WT_General;
+}
+
+QByteArray MertensCl::weightOptions(const Parameters params, const bool exposednessLut)
+{
+    QByteArray options = kBuildOptions;
+    options += QString(" -D CONTRAST_MODE=%1 -D SATURATION_MODE=%2 -D EXPOSEDNESS_MODE=%3")
+            .arg(weightTerm(params.contrast))
+            .arg(weightTerm(params.saturation))
+            .arg(weightTerm(params.exposedness))
+            .toLatin1();
+    if(exposednessLut && (weightTerm(params.exposedness) != WT_Off))
+        options += " -D EXPOSEDNESS_LUT";
+    return options;
+}
+
+QByteArray MertensCl::deviceOptions(const cl_device_id device)
+{
+    // the biggest square power of two work group the device takes, up to the 16x16 krn_weightStats is written for
+    const size_t maxGroupSize = ClDevice::getDeviceMaxWorkGroupSize(device);
+    const QVector<size_t> maxItemSizes = ClDevice::getDeviceMaxWorkItemSizes(device);
+    int side = 16;
+    while((side > 1)
+          && ((static_cast<size_t>(side * side) > maxGroupSize)
+              || (maxItemSizes.count() < 2)
+              || (static_cast<size_t>(side) > std::min(maxItemSizes.at(0), maxItemSizes.at(1)))))
+    {
+        side /= 2;
+    }
+    return kBuildOptions + QString(" -D STATS_GROUP_SIZE=%1").arg(side).toLatin1();
+}
+
+QByteArray MertensCl::exposednessLutSource()
+{
+    // the per channel exposedness term of every 8 bits value, same as krn_weight computes it
+    QByteArray src("constant float kExposednessLut[256] = {");
+    for(int i = 0; i < 256; ++i)
+    {
+        const float d = i / 255.0f - 0.5f;
+        src += QByteArray::number(-d * d * 12.5f, 'g', 9) + ((i < 255) ? "f," : "f");
+    }
+    src += "};\n";
+    return src;
 }
 
 cl_command_queue MertensCl::createCommandQueue(const cl_context context, const cl_device_id device)
 {
+    // commands are ordered by their events, so independent ones may overlap where the device allows it;
+    // profiling feeds the run statistics
+    const cl_command_queue_properties properties =
+            (ClDevice::getDeviceQueueProperties(device) & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE)
+            | CL_QUEUE_PROFILING_ENABLE;
     cl_int errorCode = CL_SUCCESS;
-    const cl_command_queue queue = clCreateCommandQueue(context, device,
-                                                    #ifdef PROFILING
-                                                        CL_QUEUE_PROFILING_ENABLE,
-                                                    #else
-                                                        0,
-                                                    #endif
-                                                        &errorCode);
-    qDebug() << "created queue" << queue << errorCode << Util::toString(errorCode);
+    const cl_command_queue queue = clCreateCommandQueue(context, device, properties, &errorCode);
+    qDebug() << "created queue" << queue << "properties" << properties << errorCode << Util::toString(errorCode);
     return queue;
 }
 
-QList<QImage> MertensCl::resize(const QList<QImage> images, const cl_device_id device)
+QList<QImage> MertensCl::load(const QStringList files)
+{
+    qDebug() << "load images" << files;
+
+    // frames are shared with the cache, only layouts krn_import can't read are converted
+    const std::function<QImage (const QString&)> loadFunctor = [](const QString &file) -> QImage
+    {
+        const QImage img = ImageCache::get(file);
+        if(img.isNull() || (nativeLayout(img.format()) != NL_max))
+            return img;
+        return img.convertToFormat(isHighBitDepth(img.format()) ? QImage::Format_RGBA64 : QImage::Format_RGBA8888);
+    };
+    const QList<QImage> images = QtConcurrent::blockingMapped<QList<QImage>>(files, loadFunctor);
+    for(int i = 0; i < images.count(); ++i)
+    {
+        if(images.at(i).isNull())
+            return QList<QImage>();
+    }
+    return images;
+}
+
+QSize MertensCl::calcFrameSize(const QVector<QSize> sizes, const cl_device_id device)
 {
-    qDebug() << "resize images" << images;
-    if(images.isEmpty())
-        return images;
+    if(sizes.isEmpty())
+        return QSize();
 
-    QSize minSize = images.first().size();
-    for(int i = 1; i < images.count(); ++i)
+    QSize minSize = sizes.first();
+    for(int i = 1; i < sizes.count(); ++i)
     {
-        const QSize s(images.at(i).size());
+        const QSize s(sizes.at(i));
         minSize = QSize(std::min(minSize.width(), s.width()),
                         std::min(minSize.height(), s.height()));
     }
 
-    const QSize supportedSize = ClDevice::getDeviceImageSize(device);
+    // pyramid atlases are one and a half times wider than the image,
+    // and rounding up the levels' heights may add a row per level
+    const QSize deviceSize = ClDevice::getDeviceImageSize(device);
+    const QSize supportedSize(deviceSize.width() * 2 / 3, deviceSize.height() - 32);
     qDebug() << "supportedSize" << supportedSize;
     const QSize newSize = minSize.boundedTo(supportedSize);
     qDebug() << "newSize" << newSize;
+    return newSize;
+}
 
-    const std::function<QImage (const QImage&)> mapFunctor =
-            [newSize](const QImage &img) -> QImage
-    {
-        return img.scaled(newSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation)
-                .convertToFormat(QImage::Format_RGBA8888);
-    };
-    static const std::function<void (QList<QImage>&, const QImage&)> reduceFunctor =
-            [](QList<QImage> &all, const QImage &one) -> void
+MertensCl::NativeLayout MertensCl::nativeLayout(const QImage::Format format)
+{
+    switch(format)
     {
-        if(!one.isNull()) all.append(one);
-    };
-    const QList<QImage> result = QtConcurrent::blockingMappedReduced<QList<QImage>>(images, mapFunctor, reduceFunctor);
+        case QImage::Format_RGB888:     return NL_Rgb888;
+        case QImage::Format_RGB32:
+        case QImage::Format_ARGB32:     return (QSysInfo::ByteOrder == QSysInfo::LittleEndian) ? NL_Bgra8888 : NL_max;
+        case QImage::Format_RGBX8888:
+        case QImage::Format_RGBA8888:   return NL_Rgba8888;
+        case QImage::Format_RGBX64:
+        case QImage::Format_RGBA64:     return NL_Rgba16;
+        case QImage::Format_Grayscale8: return NL_Gray8;
+        default:                        return NL_max;
+    }
+}
 
-    return result;
+int MertensCl::calcPyrHeight(const QSize size, const int maxPyrHeight)
+{
+    const int height = logf(std::min(size.width(), size.height())) / logf(2.0);
+    return (maxPyrHeight > 0) ? std::min(height, maxPyrHeight) : height;
 }
 
-QVector<cl_mem> MertensCl::createImages(const cl_context context, const cl_mem_flags flags, const QList<QImage> images)
+int MertensCl::calcStripAlignment(const FusionMode fusion, const int pyrHeight)
 {
-    cl_int error;
-    QVector<cl_mem> mems;
-    for(int i = 0; i < images.count(); ++i)
+    // strips start on rows the deepest level samples, so their levels line up with the ones of the whole frame;
+    // the guided filter has no levels to line up
+    return ((fusion == FM_GuidedFilter) || (pyrHeight < 1)) ? 1 : (1 << (pyrHeight - 1));
+}
+
+cl_image_format MertensCl::pyrFormat(const FusionMode fusion)
+{
+    // the luma is all FM_LumaChroma blends on the pyramids
+    return (fusion == FM_LumaChroma) ? kFormatRHalf : kFormatRgbaHalf;
+}
+
+int MertensCl::calcWeightLevel(const int weightLevel, const FusionMode fusion, const int pyrHeight)
+{
+    // the guided filter needs the weights at full size, the luma atlases can't hold the reduced colors they measure,
+    // the pyramid ones have to stay within the pyramid
+    return (fusion != FM_Pyramid) ? 0 : qBound(0, weightLevel, std::min(kMaxWeightLevel, pyrHeight - 1));
+}
+
+QVector<QRect> MertensCl::calcPyrLevels(const QSize size, const int pyrHeight)
+{
+    // classic mipmap layout: level 0 at the origin, level 1 to its right, every next level below the previous one
+    QVector<QRect> levels;
+    QSize tmpSize = size;
+    QPoint origin(0, 0);
+    for(int i = 0; i < pyrHeight; ++i)
     {
-        const QImage image(images.at(i));
-        if(image.isNull())
-            continue;
+        levels.append(QRect(origin, tmpSize));
+        origin = (i == 0) ? QPoint(tmpSize.width(), 0) : QPoint(origin.x(), origin.y() + tmpSize.height());
+        tmpSize /= 2;
+    }
+    return levels;
+}
 
-        const cl_mem obj = clCreateImage2D(context,
-                                           flags | CL_MEM_USE_HOST_PTR,
-                                           &kFormatRgbaUnormInt8,
-                                           image.width(),
-                                           image.height(),
-                                           0,
-                                           const_cast<uchar*>(image.constBits()),
-                                           &error);
-        qDebug() << "created image" << obj << error << Util::toString(error);
-        if(obj)
-        {
-            mems.append(obj);
-        }
+QSize MertensCl::calcAtlasSize(const QVector<QRect> levels)
+{
+    QRect bounds;
+    for(int i = 0; i < levels.count(); ++i)
+    {
+        bounds = bounds.united(levels.at(i));
     }
-    return mems;
+    return bounds.size();
 }
 
-int MertensCl::calcPyrHeight(const QSize size)
+cl_image_format MertensCl::imageFormat(const QImage::Format format)
 {
-    return logf(std::min(size.width(), size.height())) / logf(2.0);
+    switch(format)
+    {
+        case QImage::Format_RGBA64: return kFormatRgbaUnormInt16;
+        case QImage::Format_RGB32:  return kFormatRgb32;
+        default:                    return kFormatRgbaUnormInt8;
+    }
 }
 
 QImage MertensCl::assertAndProcess()
 {
-    if(!mContext || !mDevice || mImages.isEmpty())
+    QElapsedTimer timer;
+    timer.start();
+    mStatistics = Statistics();
+    ClMemory::resetPeak();
+    mResultMipmaps.clear();
+    if(!mContext || !mDevice || mFiles.isEmpty())
         return QImage();
 
     Runtime runtime = mRuntimes.value(mContext).value(mDevice);
@@ -455,15 +815,9 @@ QImage MertensCl::assertAndProcess()
         return QImage();
     }
 
-    bool areImagesReady = mCachedImages.count() == mImages.count();
-    if(!areImagesReady)
-    {
-        qDebug() << "images are not ready";
-        areImagesReady = allocProcessingImages();
-    }
-    if(!areImagesReady)
+    if(!mFrameSize.isValid() && !readFrameHeaders())
     {
-        qDebug() << "can't load or create images";
+        qDebug() << "can't read image headers";
         clearProcessingData();
         return QImage();
     }
@@ -480,290 +834,996 @@ QImage MertensCl::assertAndProcess()
     mMaxLocalGroupSizes[0] = sizes[0];
     mMaxLocalGroupSizes[1] = sizes[1];
 
-    mProfile.clear();
-
-    return process(runtime, mCachedImages.first().size());
-}
+    specializeWeights(runtime);
 
-bool MertensCl::allocProcessingImages()
-{
-    mCachedImages = resize(mImages, mDevice);
-    if(mCachedImages.count() != mImages.count())
+    const QSize size = mFrameSize;
+    const bool highBitDepth = (mFrameFormat == QImage::Format_RGBA64);
+    if(mMemProcessingImgs.isEmpty())
     {
-        qDebug() << "unable to cache images";
-        return false;
+        mPlan = planExecution(size, mFiles.count(), mDevice, highBitDepth, mParams.fusion, mParams.weightLevel,
+                              mParams.maxPyrHeight, mParams.firstStrategy);
     }
 
-    mMemSrcImages = createImages(mContext, CL_MEM_READ_ONLY, mCachedImages);
-    if(mMemSrcImages.count() != mCachedImages.count())
+    // allocations may still fail at runtime, every failure moves on to the next strategy
+    while(mPlan.isValid())
     {
-        qDebug() << "unable to load images into textures";
-        return false;
+        qDebug() << "execution plan" << mPlan;
+        if(mMemProcessingImgs.isEmpty()
+           && ((mCachedImages.isEmpty() && !cacheImages())
+               || !allocProcessingImages()
+               || !importResidentImages(runtime)))
+        {
+            qDebug() << "can't create images for the plan";
+        }
+        else
+        {
+            mProfile.clear();
+            const QImage result = process(runtime);
+            if(!result.isNull())
+                collectStatistics(runtime, timer.nsecsElapsed() / 1e6);
+            releaseEvents();
+            if(!result.isNull())
+                return result;
+            qDebug() << "can't process with the plan";
+        }
+        releaseDeviceData();
+        mPlan = planExecution(size, mFiles.count(), mDevice, highBitDepth, mParams.fusion, mParams.weightLevel,
+                              mParams.maxPyrHeight, static_cast<Strategy>(mPlan.strategy + 1));
     }
 
-    const QSize size = mCachedImages.first().size();
-    cl_int error;
+    qDebug() << "no execution plan fits the device";
+    clearProcessingData();
+    return QImage();
+}
 
-    for(int i = 0; i < PI_max; ++i)
+void MertensCl::specializeWeights(Runtime &runtime)
+{
+    // 8 bits frames measured at full size look the exposedness up, the others and reduced frames compute it
+    const bool exposednessLut = (mFrameFormat == QImage::Format_RGBA8888)
+                                && ((mParams.weightLevel <= 0) || (mParams.fusion != FM_Pyramid));
+    const QByteArray options = weightOptions(mParams, exposednessLut);
+    Runtime &cached = mRuntimes[mContext][mDevice];
+    if(!cached.weightKernels.contains(options))
     {
-        const ProcessingImage type = static_cast<ProcessingImage>(i);
-        const cl_image_format format = sFormatsMap.value(type, {0, 0});
-        const cl_mem img = clCreateImage2D(mContext,
-                                           CL_MEM_READ_WRITE,
-                                           &format,
-                                           size.width(),
-                                           size.height(),
-                                           0,
-                                           nullptr,
-                                           &error);
-        qDebug() << "created img" << type << img << error << Util::toString(error);
-        if(img && (error == CL_SUCCESS))
+        qDebug() << "compile weight variant" << options;
+        const cl_program program = createProgram(mContext, options.contains("EXPOSEDNESS_LUT")
+                                                 ? exposednessLutSource()
+                                                 : QByteArray());
+        KernelInfo info;
+        if(program && buildProgram(program, mDevice, options))
         {
-            mMemProcessingImgs.append(img);
+            info = createKernel(program, mDevice, KT_Weight);
         }
-    }
-    if(mMemProcessingImgs.count() != PI_max)
-    {
-        qDebug() << "unable to allocate temporary textures";
-        return false;
-    }
-
-    for(int i = 0; i < mCachedImages.count(); ++i)
-    {
-        const cl_mem img = clCreateImage2D(mContext,
-                                           CL_MEM_READ_WRITE,
-                                           &kFormatRHalf,
-                                           size.width(),
-                                           size.height(),
-                                           0,
-                                           nullptr,
-                                           &error);
-        qDebug() << "created weight" << img << error << Util::toString(error);
-        if(img && (error == CL_SUCCESS))
+        if(program)
+            clReleaseProgram(program); // the kernel keeps its own reference
+        if(!info.kernel)
         {
-            mMemWeights.append(img);
+            qDebug() << "unable to create weight variant, the generic one is used";
+            info = cached.kernels.value(KT_Weight);
         }
-    }
-    if(mMemWeights.count() != mCachedImages.count())
-    {
-        qDebug() << "unable to allocate weight textures";
-        return false;
+        cached.weightKernels[options] = info;
     }
 
-    mPyrHeight = calcPyrHeight(size);
-    qDebug() << "pyramids height" << mPyrHeight;
-    QSize tmpSize = size;
-    for(int i = 0; i < mPyrHeight; ++i)
+    runtime.kernels[KT_Weight] = cached.weightKernels.value(options);
+}
+
+bool MertensCl::prepareFrames(const Runtime &runtime)
+{
+    if(mPlan.strategy != S_Incremental)
+        return true;
+
+    // only frames new to the list build their pyramid, weights are redone after the measures changed
+    const QSize size = mPlan.size;
+    int prepared = 0;
+    for(int i = 0; i < mMemSrcImages.count(); ++i)
     {
-        mPyrSizes.append(tmpSize);
+        const int stages = mFrameStages.at(i);
+        if(!(stages & FS_Weight)
+           && !createWeightMap(runtime, mMemSrcImages.at(i), size, mParams, mMemWeights.at(i)))
         {
-            const cl_mem img = clCreateImage2D(mContext,
-                                               CL_MEM_READ_WRITE,
-                                               &kFormatRgbaHalf,
-                                               tmpSize.width(),
-                                               tmpSize.height(),
-                                               0,
-                                               nullptr,
-                                               &error);
-            qDebug() << "created img pyr" << tmpSize << img << error << Util::toString(error);
-            if(img && (error == CL_SUCCESS))
-                mMemImagePyramid.append(img);
-        }
-        {
-            const cl_mem weight = clCreateImage2D(mContext,
-                                                  CL_MEM_READ_WRITE,
-                                                  &kFormatRgbaHalf,
-                                                  tmpSize.width(),
-                                                  tmpSize.height(),
-                                                  0,
-                                                  nullptr,
-                                                  &error);
-            qDebug() << "created weight pyr" << tmpSize << weight << error << Util::toString(error);
-            if(weight && (error == CL_SUCCESS))
-                mMemWeightPyramid.append(weight);
+            qDebug() << "unable to create weight map of frame #" << i;
+            return false;
         }
+        if(!(stages & FS_Pyramid) && !buildImagePyr(runtime, size, mMemSrcImages.at(i), mMemFramePyramids.at(i)))
         {
-            const cl_mem result = clCreateImage2D(mContext,
-                                                  CL_MEM_READ_WRITE,
-                                                  &kFormatRgbaHalf,
-                                                  tmpSize.width(),
-                                                  tmpSize.height(),
-                                                  0,
-                                                  nullptr,
-                                                  &error);
-            qDebug() << "created result pyr" << tmpSize << result << error << Util::toString(error);
-            if(result && (error == CL_SUCCESS))
-                mMemResultPyramid.append(result);
+            qDebug() << "unable to build pyramid of frame #" << i;
+            return false;
         }
+        prepared += (stages != (FS_Imported | FS_Weight | FS_Pyramid)) ? 1 : 0;
+        mFrameStages[i] = FS_Imported | FS_Weight | FS_Pyramid;
+    }
+    qDebug() << "prepared" << prepared << "of" << mMemSrcImages.count() << "frames";
+    return true;
+}
+
+bool MertensCl::readFrameHeaders()
+{
+    // the list changes reset the frame size, reading it back takes the headers only
+    QVector<QSize> sizes;
+    bool highBitDepth = false;
+    for(int i = 0; i < mFiles.count(); ++i)
+    {
+        QImageReader reader(mFiles.at(i));
+        QSize size = reader.size();
+        QImage::Format format = reader.imageFormat();
+        if(!size.isValid() || (format == QImage::Format_Invalid))
         {
-            const cl_mem img = clCreateImage2D(mContext,
-                                               CL_MEM_READ_WRITE,
-                                               &kFormatRgbaHalf,
-                                               tmpSize.width(),
-                                               tmpSize.height(),
-                                               0,
-                                               nullptr,
-                                               &error);
-            qDebug() << "created rgbahalf pyr" << tmpSize << img << error << Util::toString(error);
-            if(img && (error == CL_SUCCESS))
-                mMemPyrRgbaHalf1.append(img);
+            // not every decoder tells them without decoding
+            const QImage img = ImageCache::get(mFiles.at(i));
+            size = img.size();
+            format = img.format();
         }
+        if(!size.isValid())
         {
-            const cl_mem img = clCreateImage2D(mContext,
-                                               CL_MEM_READ_WRITE,
-                                               &kFormatRgbaHalf,
-                                               tmpSize.width(),
-                                               tmpSize.height(),
-                                               0,
-                                               nullptr,
-                                               &error);
-            qDebug() << "created rgbahalf pyr2" << tmpSize << img << error << Util::toString(error);
-            if(img && (error == CL_SUCCESS))
-                mMemPyrRgbaHalf2.append(img);
+            qDebug() << "unable to read header of" << mFiles.at(i);
+            mFrameSize = QSize();
+            mFrameFormat = QImage::Format_Invalid;
+            return false;
         }
-        tmpSize /= 2;
+        sizes.append(size);
+        highBitDepth |= isHighBitDepth(format);
+    }
+    mFrameSize = calcFrameSize(sizes, mDevice);
+    mFrameFormat = highBitDepth ? QImage::Format_RGBA64 : QImage::Format_RGBA8888;
+    return true;
+}
+
+bool MertensCl::isAdoptingKeptFrames()const
+{
+    return (mPlan.strategy == S_Incremental) && (mKeptFrameSize == mPlan.passSize)
+           && (mKeptFrameFormat == mFrameFormat);
+}
+
+bool MertensCl::cacheImages()
+{
+    // kept frames are on the device already, only the others are decoded, they stay null in the list otherwise
+    const bool isAdopting = isAdoptingKeptFrames();
+    QStringList files;
+    for(int i = 0; i < mFiles.count(); ++i)
+    {
+        if(!isAdopting || !mKeptFrames.contains(mFiles.at(i)))
+            files.append(mFiles.at(i));
     }
-    if((mMemImagePyramid.count()        != mPyrHeight)
-       || (mMemWeightPyramid.count()    != mPyrHeight)
-       || (mMemResultPyramid.count()    != mPyrHeight)
-       || (mMemPyrRgbaHalf1.count()     != mPyrHeight)
-       || (mMemPyrRgbaHalf2.count()     != mPyrHeight))
+    const QList<QImage> images = load(files);
+    if(images.count() != files.count())
     {
-        qDebug() << "unable to allocate temporary pyramids";
+        qDebug() << "unable to cache images";
+        mCachedImages.clear();
         return false;
     }
 
+    mCachedImages.clear();
+    for(int i = 0, loaded = 0; i < mFiles.count(); ++i)
+    {
+        const bool isKept = isAdopting && mKeptFrames.contains(mFiles.at(i));
+        mCachedImages.append(isKept ? QImage() : images.at(loaded++));
+    }
+    qDebug() << "loaded" << files.count() << "of" << mFiles.count() << "frames";
     return true;
 }
 
-QImage MertensCl::process(const Runtime runtime, const QSize size)
+bool MertensCl::allocProcessingImages()
 {
-    if(!runtime.isValid() || size.isEmpty())
-        return QImage();
+    const QSize size = mPlan.passSize;
+    const bool isIncremental = (mPlan.strategy == S_Incremental);
+    const int residentCount = (isIncremental || (mPlan.strategy == S_Resident)) ? mFiles.count() : 1;
+    const bool isGuided = (mParams.fusion == FM_GuidedFilter);
+    cl_int error;
 
-    //===== Create Weights
-    for(int i = 0; i < mMemSrcImages.count(); ++i)
+    // the cap changes the blending, tiled plans cap it further; the host levels only move the smallest levels
+    // off the device; the guided filter blends at full size only
+    if(!isGuided)
     {
-        if(!createWeightMap(runtime, mMemSrcImages.at(i), size, mParams, mMemWeights.at(i)))
+        const int fullHeight = mPlan.pyrHeight;
+        const int hostLevels = qBound(0, mParams.hostPyrLevels, fullHeight - 1);
+        mPyrHeight = fullHeight - hostLevels;
+        mPyrLevels = calcPyrLevels(size, mPyrHeight);
+        mPyrAtlasSize = calcAtlasSize(mPyrLevels);
+        mPyrChannels = (pyrFormat(mParams.fusion).image_channel_order == CL_R) ? 1 : 4;
+        qDebug() << "pyramids height" << mPyrHeight << "atlas" << mPyrAtlasSize << "levels" << mPyrLevels;
+
+        if(hostLevels > 0)
         {
-            qDebug() << "unable to create weight map";
-            return QImage();
+            const QVector<QRect> levels = calcPyrLevels(size, fullHeight);
+            for(int i = mPyrHeight - 1; i < fullHeight; ++i)
+            {
+                mHostLevelSizes.append(levels.at(i).size());
+            }
+            const QSize top = mHostLevelSizes.first();
+            const int count = top.width() * top.height() * mPyrChannels;
+            for(int i = 0; i < mFiles.count(); ++i)
+            {
+                mHostImageLevels.append(QVector<quint16>(count));
+                mHostWeightLevels.append(QVector<quint16>(count));
+            }
+            mHostResultLevel.fill(0, count);
+            qDebug() << "host levels" << mHostLevelSizes;
         }
     }
+    mWeightLevel = calcWeightLevel(mParams.weightLevel, mParams.fusion, mPyrHeight);
+    mWeightSize = (mWeightLevel > 0) ? mPyrLevels.at(mWeightLevel).size() : size;
 
-    //===== Clear Weights sum
-    static const cl_float4 float4Zeros = {0.0f, 0.0f, 0.0f, 0.0f};
-    MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Fill, size, float4Zeros, mMemProcessingImgs.at(PI_WeightSum)),
-                     "unable to clear weights sum map",
-                     QImage());
-
-    //===== Normalize Weights
-    if(!normalizeWeights(runtime, size))
+    // the staging buffer holds the native rows one pass needs from the biggest frame, adopted frames take none;
+    // OpenCL has no empty buffers
+    size_t stagingBytes = 1;
+    for(int i = 0; i < mCachedImages.count(); ++i)
     {
-        qDebug() << "unable to normalize weights";
-        return QImage();
+        const QImage &image = mCachedImages.at(i);
+        const double scale = static_cast<double>(image.height()) / mFrameSize.height();
+        const int rows = std::min(image.height(), static_cast<int>(std::ceil(size.height() * scale)) + 2);
+        stagingBytes = std::max<size_t>(stagingBytes, static_cast<size_t>(rows) * image.bytesPerLine());
     }
-
-    //===== Clear Result pyramid
-    for(int i = 0; i < mPyrHeight; ++i)
+    mMemStaging = ClMemory::createBuffer(mContext, CL_MEM_READ_ONLY, stagingBytes, ClMemory::MC_Staging, &error);
+    verboseDebug() << "created staging buffer" << mMemStaging << stagingBytes << error << Util::toString(error);
+    if(!mMemStaging || (error != CL_SUCCESS))
     {
-        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Fill, mPyrSizes.at(i), float4Zeros, mMemResultPyramid.at(i)),
-                         "unable to clear result pyramid",
-                         QImage());
+        qDebug() << "unable to allocate staging buffer";
+        return false;
     }
 
-    //===== Multiresolution blend
-    for(int i = 0; i < mMemSrcImages.count(); ++i)
+    // resident frames get a slot each, streamed frames are imported into a single slot one after another;
+    // kept frames are adopted along with the work already done for them
+    const bool isAdopting = isAdoptingKeptFrames();
+    const cl_image_format srcFormat = imageFormat(mFrameFormat);
+    for(int i = 0; i < residentCount; ++i)
     {
-        if(!multiresBlend(runtime, size, i))
+        if(isAdopting && mKeptFrames.contains(mFiles.at(i)))
         {
-            qDebug() << "unable to blend image #" << i;
-            return QImage();
+            const KeptFrame frame = mKeptFrames.take(mFiles.at(i));
+            verboseDebug() << "adopted frame" << mFiles.at(i) << "stages" << frame.stages;
+            mMemSrcImages.append(frame.image);
+            mMemWeights.append(frame.weight);
+            mMemFramePyramids.append(frame.pyramid);
+            mFrameStages.append(frame.stages);
+            continue;
         }
-    }
+        mFrameStages.append(0);
 
-    if(!mergeResultPyr(runtime))
-    {
-        qDebug() << "unable to reconstruct result pyramid";
+        const cl_mem img = ClMemory::createImage2D(mContext, CL_MEM_READ_WRITE, srcFormat, size,
+                                                   ClMemory::MC_Frame, &error);
+        verboseDebug() << "created src slot" << img << error << Util::toString(error);
+        if(img && (error == CL_SUCCESS))
+        {
+            mMemSrcImages.append(img);
+        }
+
+        const cl_mem weight = ClMemory::createImage2D(mContext, CL_MEM_READ_WRITE, kFormatRHalf, mWeightSize,
+                                                      ClMemory::MC_Weight, &error);
+        verboseDebug() << "created weight" << weight << error << Util::toString(error);
+        if(weight && (error == CL_SUCCESS))
+        {
+            mMemWeights.append(weight);
+        }
+
+        if(isIncremental)
+        {
+            const cl_mem pyr = ClMemory::createImage2D(mContext, CL_MEM_READ_WRITE, pyrFormat(mParams.fusion),
+                                                       mPyrAtlasSize, ClMemory::MC_FramePyramid, &error);
+            verboseDebug() << "created frame pyr" << pyr << error << Util::toString(error);
+            if(pyr && (error == CL_SUCCESS))
+            {
+                mMemFramePyramids.append(pyr);
+            }
+        }
+    }
+    // whatever wasn't adopted belongs to removed files or doesn't fit the new frames
+    releaseKeptFrames();
+    if(mMemSrcImages.count() != residentCount)
+    {
+        qDebug() << "unable to load images into textures";
+        return false;
+    }
+    if(mMemWeights.count() != residentCount)
+    {
+        qDebug() << "unable to allocate weight textures";
+        return false;
+    }
+    if(mMemFramePyramids.count() != (isIncremental ? residentCount : 0))
+    {
+        qDebug() << "unable to allocate frame pyramids";
+        return false;
+    }
+
+    // resident weights stay around until the blend, so they can be measured before it;
+    // without the statistics nothing is pruned
+    const bool canMeasureWeights = mRuntimes.value(mContext).value(mDevice).canMeasureWeights();
+    if(!canMeasureWeights && (mParams.pruneThreshold > 0.0f))
+    {
+        qDebug() << "krn_weightStats doesn't fit a work group of the device, frames are not pruned";
+    }
+    if((residentCount > 1) && canMeasureWeights)
+    {
+        mWeightStats.fill(cl_float2(), residentCount * kWeightStatsGroups * kWeightStatsGroups);
+        mMemWeightStats = ClMemory::createBuffer(mContext, CL_MEM_WRITE_ONLY, mWeightStats.count() * sizeof(cl_float2),
+                                                 ClMemory::MC_Processing, &error);
+        verboseDebug() << "created weight stats" << mMemWeightStats << error << Util::toString(error);
+        if(!mMemWeightStats || (error != CL_SUCCESS))
+        {
+            qDebug() << "unable to allocate weight statistics";
+            return false;
+        }
+    }
+
+    for(int i = 0; i < PI_max; ++i)
+    {
+        const ProcessingImage type = static_cast<ProcessingImage>(i);
+        const cl_image_format format = (type == PI_Result)
+                ? imageFormat(resultFormat())
+                : sFormatsMap.value(type, {0, 0});
+        const bool isWeight = (type == PI_WeightSum) || (type == PI_TmpRHalf);
+        // the result is read back by mapping, so it's allocated in host accessible (pinned) memory
+        const cl_mem img = ClMemory::createImage2D(mContext,
+                                                   CL_MEM_READ_WRITE | ((type == PI_Result) ? CL_MEM_ALLOC_HOST_PTR : 0),
+                                                   format,
+                                                   isWeight ? mWeightSize : size,
+                                                   ClMemory::MC_Processing,
+                                                   &error);
+        verboseDebug() << "created img" << type << img << error << Util::toString(error);
+        if(img && (error == CL_SUCCESS))
+        {
+            mMemProcessingImgs.append(img);
+        }
+    }
+    if(mMemProcessingImgs.count() != PI_max)
+    {
+        qDebug() << "unable to allocate temporary textures";
+        return false;
+    }
+
+    if(mWeightLevel > 0)
+    {
+        mMemWeightSource = ClMemory::createImage2D(mContext, CL_MEM_READ_WRITE, kFormatRgbaHalf, mWeightSize,
+                                                   ClMemory::MC_Processing, &error);
+        verboseDebug() << "created weight source" << mMemWeightSource << mWeightSize << error << Util::toString(error);
+        if(!mMemWeightSource || (error != CL_SUCCESS))
+        {
+            qDebug() << "unable to allocate weight source";
+            return false;
+        }
+    }
+
+    if(isGuided)
+    {
+        for(int i = 0; i < GI_max; ++i)
+        {
+            const GuidedImage type = static_cast<GuidedImage>(i);
+            const cl_mem img = ClMemory::createImage2D(mContext, CL_MEM_READ_WRITE, sGuidedFormatsMap.value(type), size,
+                                                       ClMemory::MC_Processing, &error);
+            verboseDebug() << "created guided img" << type << img << error << Util::toString(error);
+            if(img && (error == CL_SUCCESS))
+            {
+                mMemGuidedImgs.append(img);
+            }
+        }
+        if(mMemGuidedImgs.count() != GI_max)
+        {
+            qDebug() << "unable to allocate guided filter textures";
+            return false;
+        }
+        return true;
+    }
+
+    for(int i = 0; i < PA_max; ++i)
+    {
+        const cl_mem img = ClMemory::createImage2D(mContext, CL_MEM_READ_WRITE, pyrFormat(mParams.fusion),
+                                                   mPyrAtlasSize, ClMemory::MC_Pyramid, &error);
+        verboseDebug() << "created pyr atlas" << i << img << error << Util::toString(error);
+        if(img && (error == CL_SUCCESS))
+        {
+            mMemPyramids.append(img);
+        }
+    }
+    if(mMemPyramids.count() != PA_max)
+    {
+        qDebug() << "unable to allocate temporary pyramids";
+        return false;
+    }
+
+    mMemBlendSum = ClMemory::createBuffer(mContext, CL_MEM_READ_WRITE,
+                                          Util::byteCount(mPyrAtlasSize, pyrFormat(mParams.fusion)),
+                                          ClMemory::MC_Pyramid, &error);
+    verboseDebug() << "created blend sum" << mMemBlendSum << error << Util::toString(error);
+    if(!mMemBlendSum || (error != CL_SUCCESS))
+    {
+        qDebug() << "unable to allocate blend sum";
+        return false;
+    }
+    // tiles are cut from the levels, the atlas space between them is never written
+    mBlendTileRects.clear();
+    for(int i = 0; i < mPyrLevels.count(); ++i)
+    {
+        const QRect level = mPyrLevels.at(i);
+        for(int y = 0; y < level.height(); y += sBlendTileSize)
+        {
+            for(int x = 0; x < level.width(); x += sBlendTileSize)
+            {
+                const cl_int4 tile = {level.x() + x, level.y() + y,
+                                      std::min(sBlendTileSize, level.width() - x),
+                                      std::min(sBlendTileSize, level.height() - y)};
+                mBlendTileRects.append(tile);
+            }
+        }
+    }
+    const int tileCount = mBlendTileRects.count();
+    mMemBlendTiles = ClMemory::createBuffer(mContext, CL_MEM_READ_WRITE,
+                                            (mBlendTileCounts.count() + tileCount) * sizeof(cl_int),
+                                            ClMemory::MC_Processing, &error);
+    verboseDebug() << "created blend tiles" << mMemBlendTiles << tileCount << error << Util::toString(error);
+    if(!mMemBlendTiles || (error != CL_SUCCESS))
+    {
+        qDebug() << "unable to allocate blend tile list";
+        return false;
+    }
+    mMemBlendTileRects = ClMemory::createBuffer(mContext, CL_MEM_READ_ONLY, tileCount * sizeof(cl_int4),
+                                                ClMemory::MC_Processing, &error);
+    verboseDebug() << "created blend tile rects" << mMemBlendTileRects << error << Util::toString(error);
+    if(!mMemBlendTileRects || (error != CL_SUCCESS))
+    {
+        qDebug() << "unable to allocate blend tile table";
+        return false;
+    }
+
+    // chroma is blended at half size, when the pyramid has that level
+    if(mParams.fusion == FM_LumaChroma)
+    {
+        mChromaLevel = std::min(1, mPyrHeight - 1);
+        mMemChromaSum = ClMemory::createBuffer(mContext, CL_MEM_READ_WRITE,
+                                               Util::byteCount(mPyrLevels.at(mChromaLevel).size(), kFormatRgHalf),
+                                               ClMemory::MC_Pyramid, &error);
+        verboseDebug() << "created chroma sum" << mMemChromaSum << error << Util::toString(error);
+        if(!mMemChromaSum || (error != CL_SUCCESS))
+        {
+            qDebug() << "unable to allocate chroma sum";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool MertensCl::importResidentImages(const Runtime &runtime)
+{
+    if((mPlan.strategy != S_Resident) && (mPlan.strategy != S_Incremental))
+        return true;
+
+    for(int i = 0; i < mMemSrcImages.count(); ++i)
+    {
+        if(mFrameStages.at(i) & FS_Imported)
+            continue;
+        if(!uploadImage(runtime, i, QRect(QPoint(0, 0), mFrameSize), mMemSrcImages.at(i)))
+        {
+            qDebug() << "unable to import image #" << i;
+            return false;
+        }
+        mFrameStages[i] |= FS_Imported;
+    }
+
+    // the device keeps the imported frames, the host ones aren't needed once the uploads are done
+    MERTENSCL_ASSERT(clFinish(runtime.queue), "unable to finish frames import", false);
+    mCachedImages.clear();
+    return true;
+}
+
+QImage MertensCl::process(const Runtime &runtime)
+{
+    if(!runtime.isValid() || !mPlan.isValid())
         return QImage();
+
+    const QSize size = mPlan.size;
+
+    // the tile counts of the run add up over every frame and strip
+    if(mMemBlendTiles)
+    {
+        static const cl_int noCounts[3] = {0, 0, 0};
+        Dispatch clear(Dispatch::DT_Write, "clEnqueueWriteBuffer", ST_Upload);
+        clear.range[0] = sizeof(noCounts);
+        clear.hostPtr = noCounts;
+        clear.writes.append(mMemBlendTiles);
+        const cl_int err = enqueue(runtime, clear);
+        MERTENSCL_ASSERT(err, "unable to clear blend tile counts", QImage());
+    }
+
+    if(mPlan.strategy != S_Tiled)
+    {
+        if(!prepareFrames(runtime) || !fuse(runtime, QRect(QPoint(0, 0), size), 0))
+            return QImage();
+
+        qDebug() << "read result";
+        const QImage img = toImage(runtime, size, mMemProcessingImgs.at(PI_Result));
+        if(!img.isNull() && (mParams.mipmapsAbove > 0)
+           && ((size.width() > mParams.mipmapsAbove) || (size.height() > mParams.mipmapsAbove)))
+        {
+            mResultMipmaps = readMipmaps(runtime);
+        }
+
+        printProfilingInfo();
+        return img;
     }
 
-    MERTENSCL_ASSERT(enqueueKernel(runtime, KT_ToRgba, size,
-                                   mMemResultPyramid.at(0), mMemProcessingImgs.at(PI_Result)),
-                     "unable to convert final image",
-                     QImage());
+    //===== Fuse strip by strip, only the rows away from the strip borders are kept
+    QImage img = ImageBufferPool::create(size, resultFormat());
+    const int passHeight = mPlan.passSize.height();
+    const int coreHeight = passHeight - mPlan.overlap * 2;
+    const int align = calcStripAlignment(mParams.fusion, mPlan.pyrHeight);
+    int pass = 0;
+    for(int coreY = 0; coreY < size.height(); coreY += coreHeight, ++pass)
+    {
+        // aligning moves the strip up by less than the alignment, the overlap has that much to spare
+        const int passY = qBound(0, (coreY - mPlan.overlap) / align * align, size.height() - passHeight);
+        const QRect area(0, passY, size.width(), passHeight);
+        const QRect core(0, coreY - passY, size.width(), std::min(coreHeight, size.height() - coreY));
+        verboseDebug() << "fuse strip" << area << "core" << core;
+
+        if(!fuse(runtime, area, pass))
+            return QImage();
+
+        if(!readImage(runtime, mMemProcessingImgs.at(PI_Result), core, img, coreY))
+            return QImage();
+    }
+
+    printProfilingInfo();
+    return img;
+}
+
+bool MertensCl::fuse(const Runtime &runtime, const QRect area, const int pass)
+{
+    // the host splits a pass in three segments: it picks the frames to blend once their weights are measured,
+    // and finishes the host levels once the device is done blending
+    return runSegment(runtime, pass * 3, [this, &runtime, area]() { return enqueueWeights(runtime, area); })
+           && pruneFrames(runtime, pass * 3 + 1)
+           && runSegment(runtime, pass * 3 + 1, [this, &runtime, area]() { return enqueueBlend(runtime, area); })
+           && finishHostLevels(runtime)
+           && runSegment(runtime, pass * 3 + 2, [this, &runtime, area]() { return enqueueCollapse(runtime, area); });
+}
+
+bool MertensCl::runSegment(const Runtime &runtime, const int segment, const std::function<bool ()> enqueueSegment)
+{
+    // the first run records the commands of every segment, the following runs only replay them;
+    // the image swaps done while recording aren't repeated, the replayed commands write the very same images,
+    // so the members are put back the way the recording left them
+    QElapsedTimer timer;
+    timer.start();
+    bool isDone = false;
+    const bool isReplay = (segment < mDispatchPlan.count());
+    if(isReplay)
+    {
+        Segment &recorded = mDispatchPlan[segment];
+        isDone = replay(runtime, recorded.dispatches);
+        mMemProcessingImgs = recorded.processingImgs;
+        mMemPyramids = recorded.pyramids;
+        mMemGuidedImgs = recorded.guidedImgs;
+    }
+    else
+    {
+        QVector<Dispatch> dispatches;
+        mRecording = &dispatches;
+        isDone = enqueueSegment();
+        mRecording = nullptr;
+        if(isDone && (segment == mDispatchPlan.count()))
+            mDispatchPlan.append(Segment(dispatches, mMemProcessingImgs, mMemPyramids, mMemGuidedImgs));
+    }
+    verboseDebug() << (isReplay ? "replayed" : "recorded") << "segment" << segment
+             << "host time usec" << timer.nsecsElapsed() / 1000;
+    return isDone;
+}
+
+bool MertensCl::isPruning()const
+{
+    // streamed frames would have to be uploaded once more to be measured, so only resident ones are pruned
+    return (mParams.pruneThreshold > 0.0f) && mMemWeightStats;
+}
+
+bool MertensCl::enqueueWeights(const Runtime &runtime, const QRect area)
+{
+    const QSize size = area.size();
+    if(!runtime.isValid() || size.isEmpty())
+        return false;
+
+    const bool isStreaming = (mPlan.strategy == S_Streaming) || (mPlan.strategy == S_Tiled);
+    const bool isIncremental = (mPlan.strategy == S_Incremental);
+
+    //===== Clear Weights sum
+    mStage = ST_Weights;
+    static const cl_float4 float4Zeros = {0.0f, 0.0f, 0.0f, 0.0f};
+    MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Fill, mWeightSize, float4Zeros, mMemProcessingImgs.at(PI_WeightSum)),
+                     "unable to clear weights sum map",
+                     false);
+
+    //===== Create and sum Weights
+    for(int i = 0; i < mFiles.count(); ++i)
+    {
+        const int slot = isStreaming ? 0 : i;
+        if(isStreaming && !uploadImage(runtime, i, area, mMemSrcImages.at(slot)))
+        {
+            qDebug() << "unable to upload image #" << i;
+            return false;
+        }
+        if(!isIncremental && !createWeightMap(runtime, mMemSrcImages.at(slot), size, mParams, mMemWeights.at(slot)))
+        {
+            qDebug() << "unable to create weight map";
+            return false;
+        }
+        if(!addWeight(runtime, mWeightSize, slot))
+        {
+            qDebug() << "unable to sum weights";
+            return false;
+        }
+    }
+
+    //===== Measure every normalized weight, frames are pruned before the blend
+    if(isPruning())
+    {
+        // a fixed grid of work groups strides over the weights, so a handful of partials is read back per frame
+        const QSize grid = runtime.kernels.value(KT_WeightStats).compileSize * kWeightStatsGroups;
+        for(int i = 0; i < mFiles.count(); ++i)
+        {
+            const cl_int4 options = {mWeightSize.width(), mWeightSize.height(),
+                                     i * kWeightStatsGroups * kWeightStatsGroups, 0};
+            MERTENSCL_ASSERT(enqueueKernel(runtime, KT_WeightStats, grid,
+                                           mMemWeights.at(i), mMemProcessingImgs.at(PI_WeightSum), mMemWeightStats,
+                                           options),
+                             QString("unable to measure weight of frame %1").arg(i),
+                             false);
+        }
+        Dispatch read(Dispatch::DT_ReadBuffer, "clEnqueueReadBuffer", ST_Readback);
+        read.range[0] = mWeightStats.count() * sizeof(cl_float2);
+        read.hostPtr = mWeightStats.constData();
+        read.reads.append(mMemWeightStats);
+        const cl_int err = enqueue(runtime, read);
+        MERTENSCL_ASSERT(err, "unable to read weight statistics", false);
+    }
+
+    return true;
+}
+
+bool MertensCl::pruneFrames(const Runtime &runtime, const int nextSegment)
+{
+    QVector<int> pruned;
+    mStatistics.weightMax.clear();
+    mStatistics.weightMean.clear();
+    if(isPruning())
+    {
+        MERTENSCL_ASSERT(clFinish(runtime.queue), "unable to wait for weight statistics", false);
+        const int partials = mWeightStats.count() / mFiles.count();
+        const double pixels = static_cast<double>(mWeightSize.width()) * mWeightSize.height();
+        for(int i = 0; i < mFiles.count(); ++i)
+        {
+            float maxWeight = 0.0f;
+            double sum = 0.0;
+            for(int j = 0; j < partials; ++j)
+            {
+                const cl_float2 &stats = mWeightStats.at(i * partials + j);
+                maxWeight = std::max(maxWeight, stats.s[0]);
+                sum += stats.s[1];
+            }
+            verboseDebug() << "frame" << i << "weight max" << maxWeight << "mean" << sum / pixels;
+            mStatistics.weightMax.append(maxWeight);
+            mStatistics.weightMean.append(sum / pixels);
+            if(maxWeight < mParams.pruneThreshold)
+                pruned.append(i);
+        }
+        // weights add up to one wherever there are any, only a threshold that high prunes every frame
+        if(pruned.count() == mFiles.count())
+            pruned.clear();
+    }
+
+    // the recorded blend and everything after it skip the frames pruned back then
+    if(pruned != mPrunedFrames)
+    {
+        qDebug() << "pruned frames" << pruned << "were" << mPrunedFrames;
+        mDispatchPlan.resize(std::min(mDispatchPlan.count(), nextSegment));
+        mPrunedFrames = pruned;
+    }
+    QStringList files;
+    for(int i = 0; i < mPrunedFrames.count(); ++i)
+    {
+        files.append(mFiles.at(mPrunedFrames.at(i)));
+    }
+    mStatistics.prunedFiles = files;
+    return true;
+}
+
+bool MertensCl::enqueueBlend(const Runtime &runtime, const QRect area)
+{
+    const QSize size = area.size();
+    if(!runtime.isValid() || size.isEmpty())
+        return false;
+
+    const bool isStreaming = (mPlan.strategy == S_Streaming) || (mPlan.strategy == S_Tiled);
+    const bool isIncremental = (mPlan.strategy == S_Incremental);
+    const bool isGuided = (mParams.fusion == FM_GuidedFilter);
+    static const cl_float4 float4Zeros = {0.0f, 0.0f, 0.0f, 0.0f};
+
+    //===== Sum the weights of the remaining frames, the pruned ones hand their share over to them
+    if(!mPrunedFrames.isEmpty())
+    {
+        mStage = ST_Weights;
+        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Fill, mWeightSize, float4Zeros, mMemProcessingImgs.at(PI_WeightSum)),
+                         "unable to clear weights sum map",
+                         false);
+        for(int i = 0; i < mFiles.count(); ++i)
+        {
+            if(!mPrunedFrames.contains(i) && !addWeight(runtime, mWeightSize, i))
+            {
+                qDebug() << "unable to sum weights of remaining frames";
+                return false;
+            }
+        }
+    }
+
+    //===== Clear Result pyramid, or the layer sums of the guided filter
+    mStage = ST_Blend;
+    if(isGuided)
+    {
+        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Fill, size, float4Zeros, mMemGuidedImgs.at(GI_BaseSum)),
+                         "unable to clear base layer sum",
+                         false);
+        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Fill, size, float4Zeros, mMemGuidedImgs.at(GI_DetailSum)),
+                         "unable to clear detail layer sum",
+                         false);
+    }
+    else
+    {
+        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_FillBuffer, mPyrAtlasSize, float4Zeros, mMemBlendSum, mPyrChannels),
+                         "unable to clear result pyramid",
+                         false);
+
+        // a couple of values per tile, small next to the frames
+        Dispatch upload(Dispatch::DT_Write, "clEnqueueWriteBuffer", ST_Upload);
+        upload.range[0] = mBlendTileRects.count() * sizeof(cl_int4);
+        upload.hostPtr = mBlendTileRects.constData();
+        upload.writes.append(mMemBlendTileRects);
+        const cl_int err = enqueue(runtime, upload);
+        MERTENSCL_ASSERT(err, "unable to upload blend tile table", false);
+    }
+    if(mMemChromaSum)
+    {
+        static const cl_int chromaChannels = 2;
+        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_FillBuffer, mPyrLevels.at(mChromaLevel).size(), float4Zeros,
+                                       mMemChromaSum, chromaChannels),
+                         "unable to clear chroma sum",
+                         false);
+    }
+
+    //===== Normalize Weights and blend, streamed frames recompute their weights as they are not kept
+    for(int i = 0; i < mFiles.count(); ++i)
+    {
+        if(mPrunedFrames.contains(i))
+            continue;
+        const int slot = isStreaming ? 0 : i;
+        if(isStreaming
+           && (!uploadImage(runtime, i, area, mMemSrcImages.at(slot))
+               || !createWeightMap(runtime, mMemSrcImages.at(slot), size, mParams, mMemWeights.at(slot))))
+        {
+            qDebug() << "unable to recreate weight map of image #" << i;
+            return false;
+        }
+        if(!divideWeight(runtime, mWeightSize, slot))
+        {
+            qDebug() << "unable to normalize weights";
+            return false;
+        }
+        const cl_mem weight = mMemProcessingImgs.at(PI_TmpRHalf);
+        if(isGuided
+           ? !guidedBlend(runtime, size, mMemSrcImages.at(slot), weight)
+           : isIncremental
+             ? !blendPyr(runtime, size, mMemFramePyramids.at(slot), weight, i)
+             : !multiresBlend(runtime, size, mMemSrcImages.at(slot), weight, i))
+        {
+            qDebug() << "unable to blend image #" << i;
+            return false;
+        }
+        if(mMemChromaSum && !blendChroma(runtime, mMemSrcImages.at(slot)))
+        {
+            qDebug() << "unable to blend chroma of image #" << i;
+            return false;
+        }
+    }
+
+    //===== Move the summed levels into the Result pyramid
+    if(!isGuided)
+    {
+        Dispatch dispatch(Dispatch::DT_CopyToImage, "clEnqueueCopyBufferToImage", mStage);
+        dispatch.range[0] = mPyrAtlasSize.width();
+        dispatch.range[1] = mPyrAtlasSize.height();
+        dispatch.reads.append(mMemBlendSum);
+        dispatch.writes.append(mMemPyramids.at(PA_Result));
+        const cl_int err = enqueue(runtime, dispatch);
+        MERTENSCL_ASSERT(err, "unable to copy result pyramid", false);
+    }
+
+    return true;
+}
+
+bool MertensCl::finishHostLevels(const Runtime &runtime)
+{
+    if(mHostLevelSizes.isEmpty())
+        return true;
+
+    MERTENSCL_ASSERT(clFinish(runtime.queue), "unable to wait for the host levels", false);
+    QVector< QVector<quint16> > images;
+    QVector< QVector<quint16> > weights;
+    for(int i = 0; i < mHostImageLevels.count(); ++i)
+    {
+        if(mPrunedFrames.contains(i))
+            continue;
+        images.append(mHostImageLevels.at(i));
+        weights.append(mHostWeightLevels.at(i));
+    }
+    const QVector<quint16> result = MertensReference::blendLevels(images, weights, mHostLevelSizes, mPyrChannels);
+    if(result.count() != mHostResultLevel.count())
+    {
+        qDebug() << "unable to blend host levels";
+        return false;
+    }
+    std::copy(result.constBegin(), result.constEnd(), mHostResultLevel.data());
+    return true;
+}
+
+bool MertensCl::enqueueCollapse(const Runtime &runtime, const QRect area)
+{
+    const QSize size = area.size();
+    if(!runtime.isValid() || size.isEmpty())
+        return false;
+
+    if(mParams.fusion == FM_GuidedFilter)
+    {
+        mStage = ST_Readback;
+        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_GuidedResult, size,
+                                       mMemGuidedImgs.at(GI_BaseSum),
+                                       mMemGuidedImgs.at(GI_DetailSum),
+                                       mMemProcessingImgs.at(PI_Result)),
+                         "unable to merge guided filter layers",
+                         false);
+        return true;
+    }
+
+    // the blend of the host levels replaces the smallest device level before it's collapsed
+    if(!mHostLevelSizes.isEmpty()
+       && !transferHostLevel(runtime, Dispatch::DT_WriteImage, mMemPyramids.at(PA_Result), mHostResultLevel.data()))
+    {
+        qDebug() << "unable to upload host levels";
+        return false;
+    }
+
+    if(!mergeResultPyr(runtime))
+    {
+        qDebug() << "unable to reconstruct result pyramid";
+        return false;
+    }
+
+    mStage = ST_Readback;
+    if(!convertLevel(runtime, mMemPyramids.at(PA_Result), mPyrLevels.first()))
+    {
+        qDebug() << "unable to convert final image";
+        return false;
+    }
+
+    return true;
+}
 
-    qDebug() << "read result";
-    const QImage img = toImage(runtime, size, mMemProcessingImgs.at(PI_Result));
+bool MertensCl::uploadImage(const Runtime &runtime, const int imageIndex, const QRect area, const cl_mem dst)
+{
+    if(!runtime.isValid() || (imageIndex < 0) || (imageIndex >= mCachedImages.count()))
+        return false;
 
-    printProfilingInfo();
-    return img;
+    // only the native rows covered by 'area' are uploaded, krn_import expands and resamples them into 'dst'
+    const QImage &image = mCachedImages.at(imageIndex);
+    const cl_float2 scale = {static_cast<float>(image.width()) / mFrameSize.width(),
+                             static_cast<float>(image.height()) / mFrameSize.height()};
+    const int firstRow = static_cast<int>(std::floor(area.y() * scale.s[1]));
+    const int endRow = std::min(image.height(),
+                                static_cast<int>(std::ceil((area.y() + area.height()) * scale.s[1])));
+    const size_t bytes = static_cast<size_t>(endRow - firstRow) * image.bytesPerLine();
+
+    // cached images outlive the processing, so the write doesn't have to block
+    const Stage stage = mStage;
+    mStage = ST_Upload;
+    Dispatch write(Dispatch::DT_Write, "clEnqueueWriteBuffer", mStage);
+    write.range[0] = bytes;
+    write.hostPtr = image.constScanLine(firstRow);
+    write.writes.append(mMemStaging);
+    const cl_int err = enqueue(runtime, write);
+    MERTENSCL_ASSERT(err, "unable to write image", false);
+
+    const cl_int4 layout = {nativeLayout(image.format()), image.bytesPerLine(), firstRow, endRow - firstRow};
+    const cl_float4 mapping = {scale.s[0], scale.s[1], static_cast<float>(area.x()), static_cast<float>(area.y())};
+    MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Import, area.size(),
+                                   mMemStaging, dst, layout, image.width(), mapping),
+                     "unable to import image",
+                     false);
+    mStage = stage;
+    return true;
 }
 
-bool MertensCl::createWeightMap(const Runtime runtime, const cl_mem image, const QSize size,
+bool MertensCl::createWeightMap(const Runtime &runtime, const cl_mem image, const QSize size,
                                 const Parameters params, const cl_mem weightMap)
 {
     if(!runtime.isValid() || size.isEmpty())
         return false;
 
+    mStage = ST_Weights;
+
+    //===== Reduced weights measure the gaussian level of the frame, the last step writes it at the origin
+    cl_mem source = image;
+    for(int i = 0; i < mWeightLevel; ++i)
+    {
+        static const cl_float4 factor = {1.0f, 1.0f, 1.0f, 1.0f};
+        const bool isLast = (i + 1 == mWeightLevel);
+        const cl_mem dst = isLast ? mMemWeightSource : mMemPyramids.at(PA_Image);
+        const QRect srcLevel = (i == 0) ? QRect(QPoint(0, 0), size) : mPyrLevels.at(i);
+        const QRect dstLevel = isLast ? QRect(QPoint(0, 0), mWeightSize) : mPyrLevels.at(i + 1);
+        if(!filterGauss(runtime, source, dst, mMemPyramids.at(PA_RgbaHalf1), srcLevel, dstLevel, true, factor))
+        {
+            qDebug() << "unable to reduce image for weights" << i;
+            return false;
+        }
+        source = dst;
+    }
+
+    const QSize sourceSize = (mWeightLevel > 0) ? mWeightSize : size;
     const cl_float3 clparams = {params.contrast, params.saturation, params.exposedness};
-    const cl_int2 maxCoord = {size.width() - 1, size.height() - 1};
-    MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Weight, size, image, weightMap, clparams, maxCoord),
+    const cl_int2 maxCoord = {sourceSize.width() - 1, sourceSize.height() - 1};
+    MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Weight, sourceSize, source, weightMap, clparams, maxCoord),
                      "unable to create weight map",
                      false);
     return true;
 }
 
-bool MertensCl::normalizeWeights(const Runtime runtime, const QSize size)
+bool MertensCl::addWeight(const Runtime &runtime, const QSize size, const int weightIndex)
 {
     if(!runtime.isValid() || size.isEmpty())
         return false;
 
-    //===== Sum Weights
-    for(int i = 0; i < mMemWeights.count(); ++i)
-    {
-        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Add, size,
-                                       mMemWeights.at(i),
-                                       mMemProcessingImgs.at(PI_WeightSum),
-                                       mMemProcessingImgs.at(PI_TmpRHalf)),
-                         "unable to add weights",
-                         false);
-        std::swap(mMemProcessingImgs[PI_TmpRHalf], mMemProcessingImgs[PI_WeightSum]);
-    }
+    MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Add, size,
+                                   mMemWeights.at(weightIndex),
+                                   mMemProcessingImgs.at(PI_WeightSum),
+                                   mMemProcessingImgs.at(PI_TmpRHalf)),
+                     "unable to add weights",
+                     false);
+    std::swap(mMemProcessingImgs[PI_TmpRHalf], mMemProcessingImgs[PI_WeightSum]);
 
-    //===== Normalize Weights
-    for(int i = 0; i < mMemWeights.count(); ++i)
-    {
-        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Div, size,
-                                       mMemWeights.at(i),
-                                       mMemProcessingImgs.at(PI_WeightSum),
-                                       mMemProcessingImgs.at(PI_TmpRHalf)),
-                         "unable to normalize weights",
-                         false);
-        std::swap(mMemWeights[i], mMemProcessingImgs[PI_TmpRHalf]);
-    }
+    return true;
+}
+
+bool MertensCl::divideWeight(const Runtime &runtime, const QSize size, const int weightIndex)
+{
+    if(!runtime.isValid() || size.isEmpty())
+        return false;
+
+    mStage = ST_Blend;
+    MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Div, size,
+                                   mMemWeights.at(weightIndex),
+                                   mMemProcessingImgs.at(PI_WeightSum),
+                                   mMemProcessingImgs.at(PI_TmpRHalf)),
+                     "unable to normalize weights",
+                     false);
 
     return true;
 }
 
-bool MertensCl::buildGaussPyr(const Runtime runtime, const QSize size, const cl_mem src,
-                              const QVector<cl_mem> pyr, const QVector<cl_mem> tmpPyr)
+bool MertensCl::buildGaussPyr(const Runtime &runtime, const QSize size, const cl_mem src,
+                              const cl_mem pyr, const cl_mem tmpPyr)
 {
-    if(!runtime.isValid() || size.isEmpty() || pyr.isEmpty())
+    if(!runtime.isValid() || size.isEmpty() || mPyrLevels.isEmpty())
         return false;
 
-    if(!copy(runtime, size, src, pyr.first()))
+    if(!copy(runtime, mPyrLevels.first(), src, pyr))
     {
         qDebug() << "unable to copy src image into pyr 0th level";
         return false;
     }
 
-    //===== Apply Gauss blur and downsample
-    for(int i = 0; i < (mPyrHeight - 1); ++i)
+    return reducePyr(runtime, pyr, tmpPyr, 0);
+}
+
+bool MertensCl::reducePyr(const Runtime &runtime, const cl_mem pyr, const cl_mem tmpPyr, const int level)
+{
+    //===== Apply Gauss blur and downsample every level below 'level'
+    for(int i = level; i < (mPyrHeight - 1); ++i)
     {
         static const cl_float4 factor = {1.0f, 1.0f, 1.0f, 1.0f};
-        if(!filterGauss(runtime, pyr.at(i), pyr.at(i + 1), tmpPyr.at(i), mPyrSizes.at(i), mPyrSizes.at(i + 1),
-                        true, factor))
+        if(!filterGauss(runtime, pyr, pyr, tmpPyr, mPyrLevels.at(i), mPyrLevels.at(i + 1), true, factor))
         {
             qDebug() << "unable to apply gauss filter";
             return false;
@@ -773,187 +1833,572 @@ bool MertensCl::buildGaussPyr(const Runtime runtime, const QSize size, const cl_
     return true;
 }
 
-bool MertensCl::buildLaplacePyr(const Runtime runtime,
-                                const QVector<cl_mem> pyrSrc, const QVector<cl_mem> pyrDst,
-                                const QVector<cl_mem> pyrTmp1, const QVector<cl_mem> pyrTmp2)
+bool MertensCl::buildWeightPyr(const Runtime &runtime, const cl_mem weight)
+{
+    if(!runtime.isValid() || mPyrLevels.isEmpty())
+        return false;
+
+    //===== Put the reduced weight into its level
+    const cl_mem pyr = mMemPyramids.at(PA_Weight);
+    const QRect weightLevel = mPyrLevels.at(mWeightLevel);
+    const cl_int4 copyOrigins = {0, 0, weightLevel.x(), weightLevel.y()};
+    MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Copy, weightLevel.size(), weight, pyr, copyOrigins),
+                     "unable to copy weight into its level",
+                     false);
+
+    if(!reducePyr(runtime, pyr, mMemPyramids.at(PA_RgbaHalf1), mWeightLevel))
+        return false;
+
+    //===== Expand the bigger ones, the frame's gauss pyramid is done with by now
+    for(int i = mWeightLevel; i > 0; --i)
+    {
+        const QRect bigLevel = mPyrLevels.at(i - 1);
+        const QRect smallLevel = mPyrLevels.at(i);
+        const cl_int2 maxCoord = {bigLevel.width() - 1, bigLevel.height() - 1};
+        const cl_int4 origins = {smallLevel.x(), smallLevel.y(), bigLevel.x(), bigLevel.y()};
+        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Upsample, smallLevel.size(),
+                                       pyr, mMemPyramids.at(PA_RgbaHalf1), maxCoord, origins),
+                         QString("unable to upsample weight level %1").arg(i),
+                         false);
+
+        static const cl_float4 upsampleFactor = {4.0f, 4.0f, 4.0f, 4.0f};
+        if(!filterGauss(runtime, mMemPyramids.at(PA_RgbaHalf1), pyr, mMemPyramids.at(PA_Image),
+                        bigLevel, bigLevel, false, upsampleFactor))
+        {
+            qDebug() << "unable to apply gauss for weight level" << i - 1;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool MertensCl::buildLaplacePyr(const Runtime &runtime,
+                                const cl_mem pyrSrc, const cl_mem pyrDst,
+                                const cl_mem pyrTmp1, const cl_mem pyrTmp2)
 {
     if(!runtime.isValid())
         return false;
 
+    //===== Expand every level into 'pyrTmp2'
     for(int i = 0; i < (mPyrHeight - 1); ++i)
     {
-        const QSize bigSize = mPyrSizes.at(i);
-        const QSize smallSize = mPyrSizes.at(i + 1);
-        const cl_int2 maxCoord = {bigSize.width() - 1, bigSize.height() - 1};
+        const QRect bigLevel = mPyrLevels.at(i);
+        const QRect smallLevel = mPyrLevels.at(i + 1);
+        const cl_int2 maxCoord = {bigLevel.width() - 1, bigLevel.height() - 1};
+        const cl_int4 origins = {smallLevel.x(), smallLevel.y(), bigLevel.x(), bigLevel.y()};
 
-        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Upsample, smallSize,
-                                       pyrSrc.at(i + 1), pyrTmp1.at(i), maxCoord),
+        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Upsample, smallLevel.size(),
+                                       pyrSrc, pyrTmp1, maxCoord, origins),
                          QString("unable to upsample for laplace pyramid %1").arg(i),
                          false);
 
         static const cl_float4 upsampleFactor = {4.0f, 4.0f, 4.0f, 4.0f};
-        if(!filterGauss(runtime, pyrTmp1.at(i), pyrTmp2.at(i), pyrDst.at(i), bigSize, bigSize, false, upsampleFactor))
+        if(!filterGauss(runtime, pyrTmp1, pyrTmp2, pyrDst, bigLevel, bigLevel, false, upsampleFactor))
         {
             qDebug() << "unable to apply gauss for laplace pyramid" << i;
             return false;
         }
+    }
+
+    //===== Subtract all levels at once
+    MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Sub, mPyrAtlasSize, pyrSrc, pyrTmp2, pyrDst),
+                     "unable to build laplace pyramid",
+                     false);
+
+    if(!copy(runtime, mPyrLevels.last(), pyrSrc, pyrDst))
+    {
+        qDebug() << "unable to copy the last level of src image into laplace pyr";
+        return false;
+    }
+
+    return true;
+}
+
+bool MertensCl::buildImagePyr(const Runtime &runtime, const QSize size, const cl_mem image, const cl_mem pyr)
+{
+    if(!runtime.isValid() || size.isEmpty())
+        return false;
 
-        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Sub, bigSize,
-                                       pyrSrc.at(i), pyrTmp2.at(i), pyrDst.at(i)),
-                         QString("unable to build laplace pyramid %1").arg(i),
+    mStage = ST_Pyramids;
+    if(mPyrChannels == 1)
+    {
+        // the luma pyramid starts from the luma of the frame
+        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_ToLuma, size, image, mMemPyramids.at(PA_Image)),
+                         "unable to convert image to luma",
                          false);
     }
+    if((mPyrChannels == 1)
+       ? !reducePyr(runtime, mMemPyramids.at(PA_Image), mMemPyramids.at(PA_RgbaHalf1), 0)
+       : !buildGaussPyr(runtime, size, image, mMemPyramids.at(PA_Image), mMemPyramids.at(PA_RgbaHalf1)))
+    {
+        qDebug() << "unable to create gauss pyr for image";
+        return false;
+    }
 
-    if(!copy(runtime, mPyrSizes.last(), pyrSrc.last(), pyrDst.last()))
+    if(!buildLaplacePyr(runtime, mMemPyramids.at(PA_Image), pyr,
+                        mMemPyramids.at(PA_RgbaHalf1), mMemPyramids.at(PA_Weight)))
     {
-        qDebug() << "unable to copy the last level of src image into laplace pyr";
+        qDebug() << "unable to create laplace pyr for image";
         return false;
     }
 
     return true;
 }
 
-bool MertensCl::multiresBlend(const Runtime runtime, const QSize size, const int imageIndex)
+bool MertensCl::multiresBlend(const Runtime &runtime, const QSize size, const cl_mem image, const cl_mem weight,
+                              const int frame)
+{
+    return buildImagePyr(runtime, size, image, mMemPyramids.at(PA_RgbaHalf2))
+           && blendPyr(runtime, size, mMemPyramids.at(PA_RgbaHalf2), weight, frame);
+}
+
+bool MertensCl::blendPyr(const Runtime &runtime, const QSize size, const cl_mem pyr, const cl_mem weight,
+                         const int frame)
 {
-    if(!runtime.isValid() || size.isEmpty() || (imageIndex < 0) || (imageIndex >= mCachedImages.count()))
+    if(!runtime.isValid() || size.isEmpty())
         return false;
 
-    if(!buildGaussPyr(runtime, size, mMemSrcImages.at(imageIndex), mMemImagePyramid, mMemPyrRgbaHalf1))
+    mStage = ST_Pyramids;
+    if((mWeightLevel > 0)
+       ? !buildWeightPyr(runtime, weight)
+       : !buildGaussPyr(runtime, size, weight, mMemPyramids.at(PA_Weight), mMemPyramids.at(PA_RgbaHalf1)))
     {
-        qDebug() << "unable to create gauss pyr for image" << imageIndex;
+        qDebug() << "unable to create gauss pyr for weight";
         return false;
     }
 
-    if(!buildLaplacePyr(runtime, mMemImagePyramid, mMemPyrRgbaHalf2, mMemPyrRgbaHalf1, mMemWeightPyramid))
+    //===== List the tiles the frame weighs in, at any level, the counts of the run go on
+    mStage = ST_Blend;
+    static const cl_int noTiles = 0;
+    Dispatch clear(Dispatch::DT_Write, "clEnqueueWriteBuffer", ST_Upload);
+    clear.range[0] = sizeof(cl_int);
+    clear.hostPtr = &noTiles;
+    clear.writes.append(mMemBlendTiles);
+    const cl_int err = enqueue(runtime, clear);
+    MERTENSCL_ASSERT(err, "unable to clear tile list", false);
+    const int tileCount = mBlendTileRects.count();
+    MERTENSCL_ASSERT(enqueueKernel(runtime, KT_TileList, QSize(tileCount, 1),
+                                   mMemPyramids.at(PA_Weight), mMemBlendTileRects, mMemBlendTiles,
+                                   static_cast<cl_float>(mParams.blendTileWeight)),
+                     "unable to list blended tiles",
+                     false);
+
+    //===== Blend the listed tiles of all levels at once, room is made for every tile
+    const cl_int2 options = {mPyrAtlasSize.width(), sBlendTileSize};
+    MERTENSCL_ASSERT(enqueueKernel(runtime, KT_BlendTiles, QSize(sBlendTileSize, sBlendTileSize * tileCount),
+                                   pyr, mMemPyramids.at(PA_Weight), mMemBlendTileRects, mMemBlendTiles, mMemBlendSum,
+                                   options, mPyrChannels),
+                     "unable to blend pyramids",
+                     false);
+
+    // the top of a laplacian pyramid is its gaussian level, the host goes on from there
+    if(!mHostLevelSizes.isEmpty()
+       && (!transferHostLevel(runtime, Dispatch::DT_ReadImage, pyr, mHostImageLevels[frame].data())
+           || !transferHostLevel(runtime, Dispatch::DT_ReadImage, mMemPyramids.at(PA_Weight),
+                                 mHostWeightLevels[frame].data())))
     {
-        qDebug() << "unable to create laplace pyr for image" << imageIndex;
+        qDebug() << "unable to read back host levels of frame" << frame;
         return false;
     }
 
-    if(!buildGaussPyr(runtime, size, mMemWeights.at(imageIndex), mMemWeightPyramid, mMemPyrRgbaHalf1))
+    return true;
+}
+
+bool MertensCl::blendChroma(const Runtime &runtime, const cl_mem image)
+{
+    if(!runtime.isValid() || !mMemChromaSum)
+        return false;
+
+    // the chroma of the frame is averaged by the gaussian weight level of the same size, it takes no pyramid
+    mStage = ST_Blend;
+    const QRect frame = mPyrLevels.first();
+    const QRect level = mPyrLevels.at(mChromaLevel);
+    const cl_int4 options = {frame.width() - 1, frame.height() - 1, level.x(), level.y()};
+    const cl_int blockSize = 1 << mChromaLevel;
+    MERTENSCL_ASSERT(enqueueKernel(runtime, KT_ChromaAdd, level.size(),
+                                   image, mMemPyramids.at(PA_Weight), mMemChromaSum, options, blockSize),
+                     "unable to blend chroma",
+                     false);
+    return true;
+}
+
+bool MertensCl::guidedBlend(const Runtime &runtime, const QSize size, const cl_mem image, const cl_mem weight)
+{
+    if(!runtime.isValid() || size.isEmpty())
+        return false;
+
+    // the filters mirror at the borders, which reaches one image size at most
+    const int maxRadius = std::min(size.width(), size.height()) - 1;
+    const cl_int2 maxCoord = {size.width() - 1, size.height() - 1};
+
+    //===== Split the frame, its base layer is the local mean
+    mStage = ST_Pyramids;
+    if(!boxFilter(runtime, size, image, mMemGuidedImgs.at(GI_Base), mMemGuidedImgs.at(GI_Filter1),
+                  std::min(kGuidedBaseRadius, maxRadius)))
     {
-        qDebug() << "unable to create gauss pyr for weight" << imageIndex;
+        qDebug() << "unable to create base layer";
         return false;
     }
 
-    for(int i = 0; i < mPyrHeight; ++i)
+    //===== Filter the weight once per layer, guided by the frame, and add the weighted layer up
+    static const int radii[] = {kGuidedBaseWeightRadius, kGuidedDetailWeightRadius};
+    static const float eps[] = {kGuidedBaseWeightEps, kGuidedDetailWeightEps};
+    static const GuidedImage sums[] = {GI_BaseSum, GI_DetailSum};
+    for(int layer = 0; layer < 2; ++layer)
     {
-        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Mul, mPyrSizes.at(i),
-                                       mMemPyrRgbaHalf2.at(i), mMemWeightPyramid.at(i), mMemPyrRgbaHalf1.at(i)),
-                         QString("unable to multiply pyramids for image %1").arg(imageIndex),
+        const int radius = std::min(radii[layer], maxRadius);
+        mStage = ST_Pyramids;
+        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_GuideStats, size,
+                                       image, weight, mMemGuidedImgs.at(GI_Filter1), maxCoord, radius),
+                         QString("unable to collect guided filter statistics of layer %1").arg(layer),
+                         false);
+        const cl_int4 vertical = {maxCoord.s[0], maxCoord.s[1], 0, 1};
+        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_BoxFilter, size,
+                                       mMemGuidedImgs.at(GI_Filter1), mMemGuidedImgs.at(GI_Filter2), vertical, radius),
+                         QString("unable to filter guided filter statistics of layer %1").arg(layer),
+                         false);
+        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_GuideCoeffs, size,
+                                       mMemGuidedImgs.at(GI_Filter2), mMemGuidedImgs.at(GI_Filter1), eps[layer]),
+                         QString("unable to compute guided filter coefficients of layer %1").arg(layer),
                          false);
-        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Add, mPyrSizes.at(i),
-                                       mMemResultPyramid.at(i), mMemPyrRgbaHalf1.at(i), mMemPyrRgbaHalf2.at(i)),
-                         QString("unable to add pyramids for image %1").arg(imageIndex),
+        if(!boxFilter(runtime, size, mMemGuidedImgs.at(GI_Filter1), mMemGuidedImgs.at(GI_Filter1),
+                      mMemGuidedImgs.at(GI_Filter2), radius))
+        {
+            qDebug() << "unable to filter guided filter coefficients of layer" << layer;
+            return false;
+        }
+
+        mStage = ST_Blend;
+        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_GuidedAdd, size,
+                                       image,
+                                       mMemGuidedImgs.at(GI_Base),
+                                       mMemGuidedImgs.at(GI_Filter1),
+                                       mMemGuidedImgs.at(sums[layer]),
+                                       mMemGuidedImgs.at(GI_SumTmp),
+                                       layer),
+                         QString("unable to add layer %1").arg(layer),
                          false);
-        std::swap(mMemResultPyramid[i], mMemPyrRgbaHalf2[i]);
+        std::swap(mMemGuidedImgs[sums[layer]], mMemGuidedImgs[GI_SumTmp]);
     }
 
     return true;
 }
 
-bool MertensCl::mergeResultPyr(const Runtime runtime)
+bool MertensCl::boxFilter(const Runtime &runtime, const QSize size, const cl_mem src, const cl_mem dst,
+                          const cl_mem tmp, const int radius)
+{
+    if(!runtime.isValid() || size.isEmpty())
+        return false;
+
+    // horizontal mean into 'tmp', then the vertical one into 'dst'
+    const cl_int4 horizontal = {size.width() - 1, size.height() - 1, 1, 0};
+    MERTENSCL_ASSERT(enqueueKernel(runtime, KT_BoxFilter, size, src, tmp, horizontal, radius),
+                     "unable to apply horizontal box filter",
+                     false);
+    const cl_int4 vertical = {size.width() - 1, size.height() - 1, 0, 1};
+    MERTENSCL_ASSERT(enqueueKernel(runtime, KT_BoxFilter, size, tmp, dst, vertical, radius),
+                     "unable to apply vertical box filter",
+                     false);
+    return true;
+}
+
+bool MertensCl::transferHostLevel(const Runtime &runtime, const Dispatch::Type type, const cl_mem pyr, quint16 *data)
+{
+    if(!runtime.isValid() || mPyrLevels.isEmpty())
+        return false;
+
+    const QRect level = mPyrLevels.last();
+    const bool isRead = (type == Dispatch::DT_ReadImage);
+    Dispatch dispatch(type, isRead ? "clEnqueueReadImage" : "clEnqueueWriteImage", isRead ? ST_Readback : ST_Upload);
+    dispatch.offset[0] = level.x();
+    dispatch.offset[1] = level.y();
+    dispatch.range[0] = level.width();
+    dispatch.range[1] = level.height();
+    dispatch.hostPtr = data;
+    (isRead ? dispatch.reads : dispatch.writes).append(pyr);
+    const cl_int err = enqueue(runtime, dispatch);
+    MERTENSCL_ASSERT(err, "unable to transfer host level", false);
+    return true;
+}
+
+bool MertensCl::mergeResultPyr(const Runtime &runtime)
 {
     if(!runtime.isValid())
         return false;
 
+    // collapsed levels ping-pong between the two temporary atlases, every step writes level (i - 1) only,
+    // so the level it reads from stays intact, as do all the smaller ones
+    mStage = ST_Collapse;
+    PyramidAtlas collapsed = PA_Result;
+    mCollapsedLevels.fill(0, mPyrHeight);
+    mCollapsedLevels.last() = mMemPyramids.at(PA_Result);
     for(int i = (mPyrHeight - 1); i > 0; --i)
     {
-        const QSize smallSize = mPyrSizes.at(i);
-        const QSize bigSize = mPyrSizes.at(i - 1);
-        const cl_int2 maxCoord = {bigSize.width() - 1, bigSize.height() - 1};
-
-        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Upsample, smallSize,
-                                       mMemResultPyramid.at(i), mMemPyrRgbaHalf1.at(i - 1), maxCoord),
+        const QRect smallLevel = mPyrLevels.at(i);
+        const QRect bigLevel = mPyrLevels.at(i - 1);
+        const cl_int2 maxCoord = {bigLevel.width() - 1, bigLevel.height() - 1};
+        const cl_int4 origins = {smallLevel.x(), smallLevel.y(), bigLevel.x(), bigLevel.y()};
+        const PyramidAtlas target = (collapsed == PA_RgbaHalf1) ? PA_RgbaHalf2 : PA_RgbaHalf1;
+        const PyramidAtlas blurred = (target == PA_RgbaHalf1) ? PA_RgbaHalf2 : PA_RgbaHalf1;
+
+        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Upsample, smallLevel.size(),
+                                       mMemPyramids.at(collapsed), mMemPyramids.at(target), maxCoord, origins),
                          QString("unable to upsample result pyramid lvl %1").arg(i),
                          false);
 
         static const cl_float4 upsampleFactor = {4.0f, 4.0f, 4.0f, 4.0f};
-        if(!filterGauss(runtime, mMemPyrRgbaHalf1.at(i - 1), mMemPyrRgbaHalf2.at(i - 1), mMemImagePyramid.at(i - 1),
-                        bigSize, bigSize, false, upsampleFactor))
+        if(!filterGauss(runtime, mMemPyramids.at(target), mMemPyramids.at(blurred), mMemPyramids.at(PA_Image),
+                        bigLevel, bigLevel, false, upsampleFactor))
         {
             qDebug() << "unable to blur result pyramid lvl" << i;
             return false;
         }
 
-        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Add, bigSize,
-                                       mMemResultPyramid.at(i - 1),
-                                       mMemPyrRgbaHalf2.at(i - 1),
-                                       mMemPyrRgbaHalf1.at(i - 1)),
+        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Add, bigLevel,
+                                       mMemPyramids.at(PA_Result),
+                                       mMemPyramids.at(blurred),
+                                       mMemPyramids.at(target)),
                          QString("unable to add result pyr at level %1").arg(i),
                          false);
 
-        std::swap(mMemResultPyramid[i - 1], mMemPyrRgbaHalf1[i - 1]);
+        collapsed = target;
+        mCollapsedLevels[i - 1] = mMemPyramids.at(target);
     }
 
+    // only level 0 is used from now on, so the whole atlas can be swapped
+    std::swap(mMemPyramids[PA_Result], mMemPyramids[collapsed]);
+
     return true;
 }
 
-void MertensCl::clearProcessingData()
+bool MertensCl::convertLevel(const Runtime &runtime, const cl_mem pyr, const QRect level)
 {
-    Util::release(mMemSrcImages
-                  + mMemProcessingImgs
-                  + mMemWeights
-                  + mMemResultPyramid
-                  + mMemWeightPyramid
-                  + mMemImagePyramid
-                  + mMemPyrRgbaHalf1
-                  + mMemPyrRgbaHalf2);
+    if(!runtime.isValid())
+        return false;
 
-    mPyrHeight = -1;
+    // every level goes to the corner of the result image, the luma takes the chroma along the way
+    const cl_int4 origins = {level.x(), level.y(), 0, 0};
+    if(!mMemChromaSum)
+    {
+        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_ToRgba, level.size(),
+                                       pyr, mMemProcessingImgs.at(PI_Result), origins),
+                         "unable to convert level",
+                         false);
+        return true;
+    }
+
+    const QSize chromaSize = mPyrLevels.at(mChromaLevel).size();
+    const cl_int2 chromaMaxCoord = {chromaSize.width() - 1, chromaSize.height() - 1};
+    const cl_float2 chromaScale = {static_cast<float>(chromaSize.width()) / level.width(),
+                                   static_cast<float>(chromaSize.height()) / level.height()};
+    MERTENSCL_ASSERT(enqueueKernel(runtime, KT_LumaChromaToRgba, level.size(),
+                                   pyr, mMemChromaSum, mMemProcessingImgs.at(PI_Result),
+                                   origins, chromaMaxCoord, chromaScale),
+                     "unable to convert luma and chroma of level",
+                     false);
+    return true;
+}
+
+void MertensCl::clearProcessingData()
+{
+    releaseDeviceData();
+    mPlan = ExecutionPlan();
     mMaxLocalGroupSize = -1;
     mMaxLocalGroupSizeSqrt = -1;
+    mFrameSize = QSize();
+    mFrameFormat = QImage::Format_Invalid;
     mCachedImages.clear();
+    mProfile.clear();
+}
+
+void MertensCl::releaseDeviceData()
+{
+    releaseEvents();
+    ClMemory::release(mMemSrcImages
+                      + mMemProcessingImgs
+                      + mMemWeights
+                      + mMemPyramids
+                      + mMemFramePyramids
+                      + mMemGuidedImgs);
+    ClMemory::release(mMemStaging);
+    ClMemory::release(mMemWeightSource);
+    ClMemory::release(mMemWeightStats);
+    ClMemory::release(mMemBlendSum);
+    ClMemory::release(mMemBlendTiles);
+    ClMemory::release(mMemBlendTileRects);
+    ClMemory::release(mMemChromaSum);
+
+    mMemStaging = 0;
+    mMemWeightSource = 0;
+    mMemWeightStats = 0;
+    mMemBlendSum = 0;
+    mMemBlendTiles = 0;
+    mMemBlendTileRects = 0;
+    mMemChromaSum = 0;
+    mChromaLevel = 0;
+    mBlendTileRects.clear();
+    mPyrHeight = -1;
+    mWeightLevel = 0;
+    mWeightSize = QSize();
     mMemSrcImages.clear();
     mMemProcessingImgs.clear();
     mMemWeights.clear();
-    mMemResultPyramid.clear();
-    mMemWeightPyramid.clear();
-    mMemImagePyramid.clear();
-    mMemPyrRgbaHalf1.clear();
-    mMemPyrRgbaHalf2.clear();
-    mPyrSizes.clear();
-    mProfile.clear();
+    mMemPyramids.clear();
+    mMemFramePyramids.clear();
+    mMemGuidedImgs.clear();
+    mFrameStages.clear();
+    mWeightStats.clear();
+    mPrunedFrames.clear();
+    mPyrLevels.clear();
+    mPyrAtlasSize = QSize();
+    mPyrChannels = 4;
+    mHostLevelSizes.clear();
+    mHostImageLevels.clear();
+    mHostWeightLevels.clear();
+    mHostResultLevel.clear();
+    mCollapsedLevels.clear();
+    mDispatchPlan.clear();
 }
 
-QImage MertensCl::toImage(const Runtime runtime, const QSize size, const cl_mem mem)
+void MertensCl::keepFrames(const QStringList files)
 {
-    const size_t origin[] = {0, 0, 0};
-    const size_t region[] = {static_cast<size_t>(size.width()), static_cast<size_t>(size.height()), 1};
-    QScopedArrayPointer<uchar> buffer(new uchar[size.width() * size.height() * 4]);
-#ifdef PROFILING
-    cl_event event;
-#endif
-    MERTENSCL_ASSERT(clEnqueueReadImage(runtime.queue,
-                                        mem,
-                                        CL_TRUE,
-                                        origin,
-                                        region,
-                                        0,
-                                        0,
-                                        buffer.data(),
-                                        0,
-                                        nullptr,
-                                    #ifdef PROFILING
-                                        &event
-                                    #else
-                                        nullptr
-                                    #endif
-                                        ),
-                     "unable to read image",
-                     QImage());
+    // frames kept from an earlier list stay kept only while their file is listed
+    for(auto iter = mKeptFrames.begin(); iter != mKeptFrames.end();)
+    {
+        if(files.contains(iter.key()))
+        {
+            ++iter;
+            continue;
+        }
+        const KeptFrame &frame = iter.value();
+        ClMemory::release(QVector<cl_mem>() << frame.image << frame.weight << frame.pyramid);
+        iter = mKeptFrames.erase(iter);
+    }
+
+    if((mPlan.strategy != S_Incremental) || (mMemFramePyramids.count() != mFiles.count()))
+        return;
+
+    // the frames of the current list are taken out of the vectors, so releasing the device data spares them
+    mKeptFrameSize = mPlan.passSize;
+    mKeptFrameFormat = mFrameFormat;
+    for(int i = mFiles.count() - 1; i >= 0; --i)
+    {
+        if(!files.contains(mFiles.at(i)) || !(mFrameStages.at(i) & FS_Imported))
+            continue;
+        mKeptFrames.insert(mFiles.at(i), KeptFrame(mMemSrcImages.takeAt(i),
+                                                   mMemWeights.takeAt(i),
+                                                   mMemFramePyramids.takeAt(i),
+                                                   mFrameStages.takeAt(i)));
+    }
+    qDebug() << "kept frames" << mKeptFrames.keys();
+}
+
+void MertensCl::releaseKeptFrames()
+{
+    for(auto iter = mKeptFrames.constBegin(); iter != mKeptFrames.constEnd(); ++iter)
+    {
+        const KeptFrame &frame = iter.value();
+        ClMemory::release(QVector<cl_mem>() << frame.image << frame.weight << frame.pyramid);
+    }
+    mKeptFrames.clear();
+}
+
+void MertensCl::invalidateWeights()
+{
+    for(int i = 0; i < mFrameStages.count(); ++i)
+    {
+        mFrameStages[i] &= ~FS_Weight;
+    }
+    for(auto iter = mKeptFrames.begin(); iter != mKeptFrames.end(); ++iter)
+    {
+        iter.value().stages &= ~FS_Weight;
+    }
+}
+
+QImage::Format MertensCl::resultFormat()const
+{
+    // krn_toRgba packs 8 bits results in the layout painting and encoders take without conversion
+    return mParams.highBitDepth ? QImage::Format_RGBA64 : QImage::Format_RGB32;
+}
+
+QImage MertensCl::toImage(const Runtime &runtime, const QSize size, const cl_mem mem)
+{
+    QImage img = ImageBufferPool::create(size, resultFormat());
+    return readImage(runtime, mem, QRect(QPoint(0, 0), size), img, 0) ? img : QImage();
+}
+
+QVector<QImage> MertensCl::readMipmaps(const Runtime &runtime)
+{
+    // every reduced level is converted into the corner of the result image and read back from there
+    mStage = ST_Readback;
+    QVector<QImage> mipmaps;
+    for(int i = 1; i < mCollapsedLevels.count(); ++i)
+    {
+        const QRect level = mPyrLevels.at(i);
+        if(!convertLevel(runtime, mCollapsedLevels.at(i), level))
+        {
+            qDebug() << "unable to convert result level" << i;
+            return QVector<QImage>();
+        }
+
+        QImage img = ImageBufferPool::create(level.size(), resultFormat());
+        if(!readImage(runtime, mMemProcessingImgs.at(PI_Result), QRect(QPoint(0, 0), level.size()), img, 0))
+            return QVector<QImage>();
+        mipmaps.append(img);
+    }
+    return mipmaps;
+}
+
+bool MertensCl::readImage(const Runtime &runtime, const cl_mem mem, const QRect region, QImage &dst, const int dstRow)
+{
+    if(dst.isNull())
+        return false;
+
+    const size_t origin[] = {static_cast<size_t>(region.x()), static_cast<size_t>(region.y()), 0};
+    const size_t clregion[] = {static_cast<size_t>(region.width()), static_cast<size_t>(region.height()), 1};
+    size_t rowPitch = 0;
+    cl_int err = CL_SUCCESS;
+    const QVector<cl_mem> reads = QVector<cl_mem>() << mem;
+    const QVector<cl_event> waitList = getDependencies(reads, QVector<cl_mem>());
+    cl_event event = 0;
+    const uchar *src = static_cast<const uchar*>(clEnqueueMapImage(runtime.queue,
+                                                                   mem,
+                                                                   CL_TRUE,
+                                                                   CL_MAP_READ,
+                                                                   origin,
+                                                                   clregion,
+                                                                   &rowPitch,
+                                                                   nullptr,
+                                                                   waitList.count(),
+                                                                   waitList.isEmpty() ? nullptr : waitList.constData(),
+                                                                   &event,
+                                                                   &err));
+    MERTENSCL_ASSERT(err, "unable to map image", false);
+    trackAccess(reads, QVector<cl_mem>(), event);
+    mStageEvents.append(StageEvent(event, ST_Readback, static_cast<qint64>(rowPitch) * region.height()));
 #ifdef PROFILING
-    mProfile.append({event, "clEnqueueReadImage"});
+    mProfile.append({event, "clEnqueueMapImage"});
 #endif
 
-    uchar *ptr = buffer.take();
-    return QImage(ptr, size.width(), size.height(), QImage::Format_RGBA8888,
-                  [](void *data){delete[] static_cast<uchar*>(data);}, ptr);
+    const size_t lineBytes = static_cast<size_t>(region.width()) * dst.depth() / 8;
+    for(int y = 0; y < region.height(); ++y)
+    {
+        memcpy(dst.scanLine(dstRow + y), src + y * rowPitch, lineBytes);
+    }
+
+    // later writes of 'mem' have to wait for the unmapping too
+    cl_event unmapEvent = 0;
+    MERTENSCL_ASSERT(clEnqueueUnmapMemObject(runtime.queue, mem, const_cast<uchar*>(src), 0, nullptr, &unmapEvent),
+                     "unable to unmap image",
+                     false);
+    trackAccess(reads, QVector<cl_mem>(), unmapEvent);
+    return true;
 }
 
-bool MertensCl::copy(const Runtime runtime, const QSize size, const cl_mem src, const cl_mem dst)
+bool MertensCl::copy(const Runtime &runtime, const QRect region, const cl_mem src, const cl_mem dst)
 {
-    if(!runtime.isValid() || size.isEmpty())
+    if(!runtime.isValid() || region.isEmpty())
         return false;
 
     cl_image_format srcFormat;
@@ -970,34 +2415,20 @@ bool MertensCl::copy(const Runtime runtime, const QSize size, const cl_mem src,
                                  && (srcFormat.image_channel_order == dstFormat.image_channel_order);
     if(areFormatsEqual)
     {
-        const size_t origin[] = {0, 0, 0};
-        const size_t region[] = {static_cast<size_t>(size.width()), static_cast<size_t>(size.height()), 1};
-#ifdef PROFILING
-        cl_event event;
-#endif
-        MERTENSCL_ASSERT(clEnqueueCopyImage(runtime.queue,
-                                            src,
-                                            dst,
-                                            origin,
-                                            origin,
-                                            region,
-                                            0,
-                                            nullptr,
-                                    #ifdef PROFILING
-                                            &event
-                                    #else
-                                            nullptr
-                                    #endif
-                                            ),
-                         "unable to copy image",
-                         false);
-#ifdef PROFILING
-        mProfile.append({event, "clEnqueueCopyImage"});
-#endif
+        Dispatch dispatch(Dispatch::DT_Copy, "clEnqueueCopyImage", mStage);
+        dispatch.offset[0] = region.x();
+        dispatch.offset[1] = region.y();
+        dispatch.range[0] = region.width();
+        dispatch.range[1] = region.height();
+        dispatch.reads.append(src);
+        dispatch.writes.append(dst);
+        const cl_int err = enqueue(runtime, dispatch);
+        MERTENSCL_ASSERT(err, "unable to copy image", false);
     }
     else
     {
-        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Copy, size, src, dst),
+        static const cl_int4 noOrigins = {0, 0, 0, 0};
+        MERTENSCL_ASSERT(enqueueKernel(runtime, KT_Copy, region, src, dst, noOrigins),
                          "unable to copy image",
                          false)
     }
@@ -1026,23 +2457,229 @@ void MertensCl::printProfilingInfo()
 #endif
 }
 
-bool MertensCl::filterGauss(const Runtime runtime, const cl_mem src, const cl_mem dst, const cl_mem tmp,
-                            const QSize srcSize, const QSize dstSize,
+cl_int MertensCl::enqueue(const Runtime &runtime, const Dispatch &dispatch)
+{
+    const QVector<cl_event> waitList = getDependencies(dispatch.reads, dispatch.writes);
+    const cl_uint waitCount = waitList.count();
+    const cl_event *waitEvents = waitList.isEmpty() ? nullptr : waitList.constData();
+    cl_event event = 0;
+    cl_int err = CL_SUCCESS;
+    switch(dispatch.type)
+    {
+        case Dispatch::DT_Kernel:
+            for(int i = 0; (i < dispatch.args.count()) && (err == CL_SUCCESS); ++i)
+            {
+                const QByteArray &arg = dispatch.args.at(i);
+                err = clSetKernelArg(dispatch.kernel, i, arg.size(), arg.constData());
+            }
+            MERTENSCL_ASSERT(err, "error setting args of kernel " + dispatch.name, err);
+            err = clEnqueueNDRangeKernel(runtime.queue, dispatch.kernel, 2, dispatch.offset, dispatch.range,
+                                         dispatch.local, waitCount, waitEvents, &event);
+            break;
+
+        case Dispatch::DT_Write:
+            err = clEnqueueWriteBuffer(runtime.queue, dispatch.writes.first(), CL_FALSE, 0, dispatch.range[0],
+                                       dispatch.hostPtr, waitCount, waitEvents, &event);
+            break;
+
+        case Dispatch::DT_Copy:
+            err = clEnqueueCopyImage(runtime.queue, dispatch.reads.first(), dispatch.writes.first(),
+                                     dispatch.offset, dispatch.offset, dispatch.range, waitCount, waitEvents, &event);
+            break;
+
+        case Dispatch::DT_ReadImage:
+            // the host buffer belongs to MertensCl, the dispatch only points at it
+            err = clEnqueueReadImage(runtime.queue, dispatch.reads.first(), CL_FALSE, dispatch.offset, dispatch.range,
+                                     0, 0, const_cast<void*>(dispatch.hostPtr), waitCount, waitEvents, &event);
+            break;
+
+        case Dispatch::DT_WriteImage:
+            err = clEnqueueWriteImage(runtime.queue, dispatch.writes.first(), CL_FALSE, dispatch.offset, dispatch.range,
+                                      0, 0, dispatch.hostPtr, waitCount, waitEvents, &event);
+            break;
+
+        case Dispatch::DT_ReadBuffer:
+            err = clEnqueueReadBuffer(runtime.queue, dispatch.reads.first(), CL_FALSE, 0, dispatch.range[0],
+                                      const_cast<void*>(dispatch.hostPtr), waitCount, waitEvents, &event);
+            break;
+
+        case Dispatch::DT_CopyToImage:
+            err = clEnqueueCopyBufferToImage(runtime.queue, dispatch.reads.first(), dispatch.writes.first(), 0,
+                                             dispatch.offset, dispatch.range, waitCount, waitEvents, &event);
+            break;
+    }
+    MERTENSCL_ASSERT(err, "unable to enqueue " + dispatch.name, err);
+    trackAccess(dispatch.reads, dispatch.writes, event);
+    // images are transferred by the host levels only, in the half format of the atlases
+    const qint64 bytes = ((dispatch.type == Dispatch::DT_Write) || (dispatch.type == Dispatch::DT_ReadBuffer))
+            ? static_cast<qint64>(dispatch.range[0])
+            : ((dispatch.type == Dispatch::DT_ReadImage) || (dispatch.type == Dispatch::DT_WriteImage))
+              ? static_cast<qint64>(dispatch.range[0] * dispatch.range[1] * mPyrChannels * sizeof(cl_half))
+              : 0;
+    mStageEvents.append(StageEvent(event, dispatch.stage, bytes));
+    mStatistics.dispatches += (dispatch.type == Dispatch::DT_Kernel) ? 1 : 0;
+#ifdef PROFILING
+    mProfile.append({event, dispatch.name});
+#endif
+
+    if(mRecording)
+        mRecording->append(dispatch);
+    return err;
+}
+
+bool MertensCl::replay(const Runtime &runtime, QVector<Dispatch> &dispatches)
+{
+    // weight parameters and the variant they select are the only things that change between runs,
+    // they are patched in place
+    const cl_float3 clparams = {mParams.contrast, mParams.saturation, mParams.exposedness};
+    const QByteArray params(reinterpret_cast<const char*>(&clparams), sizeof(cl_float3));
+    const cl_kernel weightKernel = runtime.kernels.value(KT_Weight).kernel;
+    for(int i = 0; i < dispatches.count(); ++i)
+    {
+        Dispatch &dispatch = dispatches[i];
+        if(dispatch.kernelType == KT_Weight)
+        {
+            dispatch.kernel = weightKernel;
+            dispatch.args[kWeightParamsArg] = params;
+        }
+        const cl_int err = enqueue(runtime, dispatch);
+        MERTENSCL_ASSERT(err, "unable to replay " + dispatch.name, false);
+    }
+    return true;
+}
+
+QVector<cl_event> MertensCl::getDependencies(const QVector<cl_mem> reads, const QVector<cl_mem> writes)const
+{
+    // reading after a write, and writing after both reads and writes
+    QVector<cl_event> events;
+    for(int i = 0; i < reads.count(); ++i)
+    {
+        const MemAccess access = mMemAccesses.value(reads.at(i));
+        if(access.write)
+            events.append(access.write);
+    }
+    for(int i = 0; i < writes.count(); ++i)
+    {
+        const MemAccess access = mMemAccesses.value(writes.at(i));
+        if(access.write)
+            events.append(access.write);
+        events += access.reads;
+    }
+    return events;
+}
+
+void MertensCl::trackAccess(const QVector<cl_mem> reads, const QVector<cl_mem> writes, const cl_event event)
+{
+    mEvents.append(event);
+    for(int i = 0; i < reads.count(); ++i)
+    {
+        mMemAccesses[reads.at(i)].reads.append(event);
+    }
+    for(int i = 0; i < writes.count(); ++i)
+    {
+        MemAccess &access = mMemAccesses[writes.at(i)];
+        access.write = event;
+        access.reads.clear();
+    }
+}
+
+void MertensCl::releaseEvents()
+{
+    // pending commands keep their own references, so nothing has to be waited for here
+    for(int i = 0; i < mEvents.count(); ++i)
+    {
+        clReleaseEvent(mEvents.at(i));
+    }
+    mEvents.clear();
+    mMemAccesses.clear();
+    mStageEvents.clear();
+}
+
+void MertensCl::collectStatistics(const Runtime &runtime, const double hostMsecs)
+{
+    // the tile counts are read once per run, a few bytes
+    if(mMemBlendTiles)
+    {
+        Dispatch read(Dispatch::DT_ReadBuffer, "clEnqueueReadBuffer", ST_Readback);
+        read.range[0] = mBlendTileCounts.count() * sizeof(cl_int);
+        read.hostPtr = mBlendTileCounts.constData();
+        read.reads.append(mMemBlendTiles);
+        if((enqueue(runtime, read) == CL_SUCCESS) && (clFinish(runtime.queue) == CL_SUCCESS))
+        {
+            mStatistics.blendedTiles = mBlendTileCounts.at(1);
+            mStatistics.blendTiles = mBlendTileCounts.at(2);
+        }
+        else
+        {
+            qDebug() << "unable to read blend tile counts";
+        }
+    }
+
+    // every event is complete once the result is read back
+    mStatistics.strategy = mPlan.strategy;
+    mStatistics.pyrHeight = mPlan.pyrHeight;
+    mStatistics.hostMsecs = hostMsecs;
+    mStatistics.frames = mFiles.count();
+    for(int i = 0; i < mStageEvents.count(); ++i)
+    {
+        const StageEvent &info = mStageEvents.at(i);
+        cl_ulong start = 0, end = 0;
+        if((info.stage == ST_max)
+           || (clGetEventProfilingInfo(info.event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, nullptr) != CL_SUCCESS)
+           || (clGetEventProfilingInfo(info.event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, nullptr) != CL_SUCCESS))
+            continue;
+
+        const double msecs = (end - start) / 1e6;
+        mStatistics.stageMsecs[info.stage] += msecs;
+        if(info.bytes <= 0)
+            continue;
+        if(info.stage == ST_Upload)
+        {
+            mStatistics.uploadBytes += info.bytes;
+            mStatistics.uploadMsecs += msecs;
+        }
+        else
+        {
+            mStatistics.readbackBytes += info.bytes;
+            mStatistics.readbackMsecs += msecs;
+        }
+    }
+
+    mStatistics.deviceBytes = ClMemory::getBytes();
+    mStatistics.peakDeviceBytes = ClMemory::getPeakBytes();
+
+    // high-water mark of the job for capacity planning
+    const QVector<qint64> bytes = ClMemory::getBytesPerCategory();
+    QStringList breakdown;
+    for(int i = 0; i < bytes.count(); ++i)
+    {
+        breakdown.append(ClMemory::toString(static_cast<ClMemory::Category>(i)) + " " + Util::toHumanText(bytes.at(i)));
+    }
+    qDebug() << "device memory peak" << Util::toHumanText(mStatistics.peakDeviceBytes)
+             << "live" << breakdown.join(", ");
+}
+
+bool MertensCl::filterGauss(const Runtime &runtime, const cl_mem src, const cl_mem dst, const cl_mem tmp,
+                            const QRect srcLevel, const QRect dstLevel,
                             const bool downScale, const cl_float4 factor)
 {
     if(!runtime.isValid())
         return false;
 
-    // horizontal blur
+    const QSize srcSize = srcLevel.size();
+    const QSize dstSize = dstLevel.size();
+
+    // horizontal blur, 'tmp' holds the intermediate result at the 'src' level position
     {
         const cl_int8 options = {srcSize.width() - 1, srcSize.height() - 1,
                                  downScale ? 2 : 1, 1,
                                  downScale ? 2 : 1, 1,
                                  1, 0};
+        const cl_int4 origins = {srcLevel.x(), srcLevel.y(), srcLevel.x(), srcLevel.y()};
         static const cl_float4 noFactor = {1.0f, 1.0f, 1.0f, 1.0f};
         MERTENSCL_ASSERT(enqueueKernel(runtime, KT_FilterGauss,
                                        QSize((downScale ? dstSize.width() : srcSize.width()), srcSize.height()),
-                                       src, tmp, options, noFactor),
+                                       src, tmp, options, noFactor, origins),
                          "unable to apply horizontal gauss filter",
                          false);
     }
@@ -1052,8 +2689,9 @@ bool MertensCl::filterGauss(const Runtime runtime, const cl_mem src, const cl_me
                                  downScale ? 2 : 1, downScale ? 2 : 1,
                                  1, 1,
                                  0, 1};
+        const cl_int4 origins = {srcLevel.x(), srcLevel.y(), dstLevel.x(), dstLevel.y()};
         MERTENSCL_ASSERT(enqueueKernel(runtime, KT_FilterGauss, dstSize,
-                                       tmp, dst, options, factor),
+                                       tmp, dst, options, factor, origins),
                          "unable to apply vertical gauss filter",
                          false);
     }
@@ -33,11 +33,13 @@ OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include <QtCore>
 #include <QtGui>
+#include <functional>
 #include "wrappersCL/ClDevice.h"
 
 class MertensCl : public QObject
 {
     Q_OBJECT
+    friend class MertensReference; // shares the frame conversions and the pyramid geometry
     Q_ENUMS(KernelType)
 
 public:
@@ -47,24 +49,144 @@ public:
         KT_Add,
         KT_Sub,
         KT_Div,
-        KT_Mul,
         KT_Fill,
         KT_Upsample,
         KT_ToRgba,
         KT_Copy,
         KT_FilterGauss,
+        KT_Import,
+        KT_BoxFilter,
+        KT_GuideStats,
+        KT_GuideCoeffs,
+        KT_GuidedAdd,
+        KT_GuidedResult,
+        KT_WeightStats,
+        KT_FillBuffer,
+        KT_TileList,
+        KT_BlendTiles,
+        KT_ToLuma,
+        KT_ChromaAdd,
+        KT_LumaChromaToRgba,
         KT_max
     };
 
+    // ordered from the fastest to the most memory-frugal
+    enum Strategy
+    {
+        S_Incremental = 0,  // resident, plus the laplacian pyramid of every frame, list changes compute new frames only
+        S_Resident,         // all frames and weights stay on the device
+        S_Streaming,        // frames are uploaded one by one, weights are computed twice
+        S_Tiled,            // streaming over overlapping horizontal strips
+        S_max
+    };
+
+    // how the normalized weights blend the frames
+    enum FusionMode
+    {
+        FM_Pyramid = 0,     // laplacian pyramids, as the algorithm is published
+        FM_GuidedFilter,    // base and detail layers with guided-filtered weights, faster, an approximation
+        FM_LumaChroma,      // laplacian pyramids of the luma, the chroma averaged at half size, an approximation
+        FM_max
+    };
+
     class Parameters
     {
     public:
         float contrast;
         float saturation;
         float exposedness;
+        bool highBitDepth;  // produce a 16 bits per channel result
+        int mipmapsAbove;   // read back the reduced levels of results bigger than it, 0 for none
+        int maxPyrHeight;   // cap of the pyramid depth, 0 for levels down to a couple of pixels
+        int hostPyrLevels;  // smallest levels finished on the host, the result stays the same
+        FusionMode fusion;
+        float pruneThreshold; // frames whose normalized weight stays below it everywhere are skipped, 0 keeps all
+        int weightLevel;    // level of the image pyramid the weights are computed at, 0 for full size
+        float blendTileWeight; // a frame leaves out the level tiles its weight stays below it in, 0 blends them all
+        Strategy firstStrategy; // the plan tried first, the next ones are taken when it doesn't fit the device
+
+        // a tile left out changes no pixel by more than 2^-11, half an ulp of a half float at 1
+        Parameters()
+            : contrast(1), saturation(1), exposedness(0), highBitDepth(false), mipmapsAbove(0), maxPyrHeight(0),
+              hostPyrLevels(0), fusion(FM_Pyramid), pruneThreshold(0), weightLevel(0), blendTileWeight(1.0f / 2048),
+              firstStrategy(S_Incremental)
+        { }
+    };
+
+    class ExecutionPlan
+    {
+    public:
+        Strategy strategy;
+        QSize size;         // size of the frames
+        QSize passSize;     // size processed at once, a strip of 'size' for tiled execution
+        int overlap;        // rows shared with the neighbour strips
+        int pyrHeight;      // pyramid depth of every pass, tiled strips take it from the whole frame
+        qint64 bytes;       // device memory footprint
+
+        ExecutionPlan(const Strategy s = S_max, const QSize sz = QSize(), const QSize ps = QSize(),
+                      const int o = 0, const int ph = 0, const qint64 b = 0)
+            : strategy(s), size(sz), passSize(ps), overlap(o), pyrHeight(ph), bytes(b)
+        { }
+
+        bool isValid()const { return strategy != S_max; }
+
+        inline friend QDebug operator <<(QDebug dbg, const ExecutionPlan &obj)
+        {
+            dbg.nospace() << "ExecutionPlan(" << "strategy=" << obj.strategy << " size=" << obj.size
+                          << " pass=" << obj.passSize << " overlap=" << obj.overlap << " height=" << obj.pyrHeight
+                          << " bytes=" << obj.bytes << ")";
+            return dbg.space();
+        }
+    };
+
+    // parts of a run, device time is accounted to them
+    enum Stage
+    {
+        ST_Upload = 0,
+        ST_Weights,
+        ST_Pyramids,
+        ST_Blend,
+        ST_Collapse,
+        ST_Readback,
+        ST_max
     };
 
-    static qint64 calcMemoryFootprint(const QSize imgSize, const int imgCount);
+    class Statistics
+    {
+    public:
+        Strategy strategy;
+        int pyrHeight;              // pyramid depth blended, host levels included
+        double hostMsecs;           // the whole run, loading and readback included
+        QVector<double> stageMsecs; // device time of every Stage
+        int dispatches;             // kernels enqueued
+        qint64 deviceBytes;         // device memory allocated after the run
+        qint64 peakDeviceBytes;     // device memory high-water mark of the run
+        qint64 uploadBytes;
+        double uploadMsecs;
+        qint64 readbackBytes;
+        double readbackMsecs;
+        int frames;
+        QStringList prunedFiles;    // frames skipped for their negligible weight
+        QVector<float> weightMax;   // highest normalized weight of every frame, measured only when pruning
+        QVector<float> weightMean;  // mean normalized weight of every frame
+        int blendTiles;             // pyramid level tiles offered to the blend, over every frame and strip
+        int blendedTiles;           // those a frame weighs in, the others are left out
+
+        Statistics()
+            : strategy(S_max), pyrHeight(0), hostMsecs(0), stageMsecs(ST_max, 0.0), dispatches(0), deviceBytes(0),
+              peakDeviceBytes(0), uploadBytes(0), uploadMsecs(0), readbackBytes(0), readbackMsecs(0), frames(0),
+              blendTiles(0), blendedTiles(0)
+        { }
+    };
+
+    static QSize calcFrameSize(const QVector<QSize> sizes, const cl_device_id device);
+    static qint64 calcMemoryFootprint(const QSize imgSize, const int imgCount, const bool highBitDepth = false,
+                                      const bool framePyramids = false, const FusionMode fusion = FM_Pyramid,
+                                      const int weightLevel = 0);
+    static ExecutionPlan planExecution(const QSize imgSize, const int imgCount, const cl_device_id device,
+                                       const bool highBitDepth = false, const FusionMode fusion = FM_Pyramid,
+                                       const int weightLevel = 0, const int maxPyrHeight = 0,
+                                       const Strategy first = S_Incremental);
 
     MertensCl();
     ~MertensCl();
@@ -73,14 +195,15 @@ public:
 
 public slots:
     void setCl(const cl_context context, const cl_device_id device);
-    void setImages(const QList<QImage> images);
+    void setFiles(const QStringList files);
     void setParameters(const MertensCl::Parameters params);
     QImage process();
 
-    QImage process(const cl_context context, const cl_device_id device, const QList<QImage> sourceImages, const MertensCl::Parameters params);
+    QImage process(const cl_context context, const cl_device_id device, const QStringList files, const MertensCl::Parameters params);
 
 signals:
-    void finished(const QImage result)const;
+    void finished(const QImage result, const QVector<QImage> mipmaps)const;
+    void statisticsChanged(const MertensCl::Statistics statistics)const;
 
 private:
     enum ProcessingImage
@@ -91,31 +214,172 @@ private:
         PI_max
     };
 
+    // every pyramid lives in one atlas image: level 0 on the left, the smaller levels stacked to its right;
+    // FM_LumaChroma atlases hold the luma only
+    enum PyramidAtlas
+    {
+        PA_Result = 0,
+        PA_Weight,
+        PA_Image,
+        PA_RgbaHalf1,
+        PA_RgbaHalf2,
+        PA_max
+    };
+
+    // FM_GuidedFilter: full-size images used instead of the pyramid atlases
+    enum GuidedImage
+    {
+        GI_Base = 0,    // base layer of the current frame
+        GI_Filter1,     // guided filter statistics and coefficients
+        GI_Filter2,
+        GI_BaseSum,     // weighted sums of the layers of all frames
+        GI_DetailSum,
+        GI_SumTmp,
+        GI_max
+    };
+
+    // layouts uploaded as they are decoded, anything else is converted on the host first
+    enum NativeLayout
+    {
+        NL_Rgb888 = 0,
+        NL_Bgra8888,    // QImage::Format_(A)RGB32 on little endian hosts
+        NL_Rgba8888,
+        NL_Rgba16,
+        NL_Gray8,
+        NL_max
+    };
+
     class KernelInfo
     {
     public:
         cl_kernel kernel;
         size_t workSize;
         size_t preferredSize;
+        QSize compileSize;      // reqd_work_group_size of the kernel, empty when it takes any
+        QString name;
 
-        KernelInfo(const cl_kernel k = 0, const size_t s = 0, const size_t ps = 0)
-            : kernel(k), workSize(s), preferredSize(ps)
+        KernelInfo(const cl_kernel k = 0, const size_t s = 0, const size_t ps = 0, const QSize cs = QSize(),
+                   const QString n = QString())
+            : kernel(k), workSize(s), preferredSize(ps), compileSize(cs), name(n)
         { }
 
         inline friend QDebug operator <<(QDebug dbg, const KernelInfo &obj)
         {
-            dbg.nospace() << "KernelInfo(" << "kernel=" << obj.kernel << " size=" << obj.workSize
-                          << " preferred=" << obj.preferredSize << ")";
+            dbg.nospace() << "KernelInfo(" << "name=" << obj.name << " kernel=" << obj.kernel << " size=" << obj.workSize
+                          << " preferred=" << obj.preferredSize << " compiled=" << obj.compileSize << ")";
             return dbg.space();
         }
     };
 
+    // work done for a resident frame, the incremental strategy does it only once per file
+    enum FrameStage
+    {
+        FS_Imported = 0x1,
+        FS_Weight   = 0x2,  // raw weight map, redone when the measures change
+        FS_Pyramid  = 0x4   // laplacian pyramid
+    };
+
+    // images of a frame that stays in the list while the others change
+    class KeptFrame
+    {
+    public:
+        cl_mem image;
+        cl_mem weight;
+        cl_mem pyramid;
+        int stages;
+
+        KeptFrame(const cl_mem i = 0, const cl_mem w = 0, const cl_mem p = 0, const int s = 0)
+            : image(i), weight(w), pyramid(p), stages(s)
+        { }
+    };
+
+    // device time of a command, 'bytes' is what a transfer moved
+    class StageEvent
+    {
+    public:
+        cl_event event;
+        Stage stage;
+        qint64 bytes;
+
+        StageEvent(const cl_event e = 0, const Stage s = ST_max, const qint64 b = 0)
+            : event(e), stage(s), bytes(b)
+        { }
+    };
+
+    // commands touching a memory object since it was last written, an out-of-order queue has to wait for them
+    class MemAccess
+    {
+    public:
+        cl_event write;
+        QVector<cl_event> reads;
+
+        MemAccess() : write(0) { }
+    };
+
+    // one command of a fusion pass with everything resolved, so replaying it costs no more than the enqueue call
+    class Dispatch
+    {
+    public:
+        enum Type
+        {
+            DT_Kernel = 0,
+            DT_Write,       // host rows into a buffer, 'range[0]' bytes from 'hostPtr'
+            DT_Copy,        // 'range' pixels at 'offset' from the read image into the written one
+            DT_ReadImage,   // 'range' pixels at 'offset' of the read image into 'hostPtr', packed
+            DT_WriteImage,  // 'range' pixels from 'hostPtr' into the written image at 'offset'
+            DT_ReadBuffer,  // 'range[0]' bytes of the read buffer into 'hostPtr'
+            DT_CopyToImage  // 'range' pixels of the read buffer's rows into the written image at 'offset'
+        };
+
+        Type type;
+        QString name;
+        Stage stage;
+        KernelType kernelType;
+        cl_kernel kernel;
+        QVector<QByteArray> args;   // argument values in their order, the kernel size included
+        size_t offset[3];
+        size_t range[3];
+        size_t local[2];
+        const void *hostPtr;
+        QVector<cl_mem> reads;
+        QVector<cl_mem> writes;
+
+        Dispatch(const Type t = DT_Kernel, const QString n = QString(), const Stage s = ST_max)
+            : type(t), name(n), stage(s), kernelType(KT_max), kernel(0),
+              offset{0, 0, 0}, range{1, 1, 1}, local{1, 1}, hostPtr(nullptr)
+        { }
+    };
+
+    // recorded commands of a pass segment, with the swapped images as the segment leaves them
+    class Segment
+    {
+    public:
+        QVector<Dispatch> dispatches;
+        QVector<cl_mem> processingImgs;
+        QVector<cl_mem> pyramids;
+        QVector<cl_mem> guidedImgs;
+
+        Segment(const QVector<Dispatch> d = QVector<Dispatch>(), const QVector<cl_mem> pi = QVector<cl_mem>(),
+                const QVector<cl_mem> p = QVector<cl_mem>(), const QVector<cl_mem> gi = QVector<cl_mem>())
+            : dispatches(d), processingImgs(pi), pyramids(p), guidedImgs(gi)
+        { }
+    };
+
+    // how a weight measure enters the product, chosen by its exponent, matches WEIGHT_* of mertens.cl
+    enum WeightTerm
+    {
+        WT_Off = 0,     // exponent 0, the measure isn't computed
+        WT_Linear,      // exponent 1, taken as it is
+        WT_General      // raised to the exponent
+    };
+
     class Runtime
     {
     public:
         cl_program program;
         cl_command_queue queue;
         QMap<KernelType, KernelInfo> kernels;
+        QMap<QByteArray, KernelInfo> weightKernels; // krn_weight variants by their build options
 
         Runtime(const cl_program program_ = 0,
                 const cl_command_queue queue_ = 0,
@@ -124,76 +388,198 @@ private:
         { }
 
         bool isValid()const { return program && queue && (kernels.count() == KT_max); }
+
+        // krn_weightStats reduces over the group it is compiled for, it can't run with a smaller one
+        bool canMeasureWeights()const
+        {
+            const KernelInfo info = kernels.value(KT_WeightStats);
+            return !info.compileSize.isEmpty()
+                   && (info.workSize >= static_cast<size_t>(info.compileSize.width() * info.compileSize.height()));
+        }
     };
 
     static const QMap<ProcessingImage, cl_image_format> sFormatsMap;
+    static const QMap<GuidedImage, cl_image_format> sGuidedFormatsMap;
+    static const int sBlendTileSize;    // side of the pyramid level tiles of the blend
 
-    static cl_program createProgram(const cl_context context);
-    static bool buildProgram(const cl_program program, const cl_device_id device);
+    static cl_program createProgram(const cl_context context, const QByteArray prefix = QByteArray());
+    static bool buildProgram(const cl_program program, const cl_device_id device, const QByteArray options);
+    static KernelInfo createKernel(const cl_program program, const cl_device_id device, const KernelType type);
     static QMap<KernelType, KernelInfo> createKernels(const cl_program program, const cl_device_id device);
+    static WeightTerm weightTerm(const float exponent);
+    static QByteArray weightOptions(const Parameters params, const bool exposednessLut);
+    static QByteArray deviceOptions(const cl_device_id device);
+    static QByteArray exposednessLutSource();
     static cl_command_queue createCommandQueue(const cl_context context, const cl_device_id device);
-    static QList<QImage> resize(const QList<QImage> images, const cl_device_id device);
+    static QList<QImage> load(const QStringList files);
+    static NativeLayout nativeLayout(const QImage::Format format);
+    static bool isHighBitDepth(const QList<QImage> images);
+    static bool isHighBitDepth(const QImage::Format format);
     static Runtime compile(const cl_context context, const cl_device_id device);
-    static QVector<cl_mem> createImages(const cl_context context, const cl_mem_flags flags, const QList<QImage> images);
-    static int calcPyrHeight(const QSize size);
+    static int calcPyrHeight(const QSize size, const int maxPyrHeight = 0);
+    static int calcStripAlignment(const FusionMode fusion, const int pyrHeight);
+    static bool fitsDevice(const QSize passSize, const int residentCount, const bool highBitDepth,
+                           const bool framePyramids, const FusionMode fusion, const int weightLevel,
+                           const qint64 budget, const qint64 maxAlloc, qint64 &bytes);
+    static QVector<QRect> calcPyrLevels(const QSize size, const int pyrHeight);
+    static QSize calcAtlasSize(const QVector<QRect> levels);
+    static int calcWeightLevel(const int weightLevel, const FusionMode fusion, const int pyrHeight);
+    static cl_image_format imageFormat(const QImage::Format format);
+    static cl_image_format pyrFormat(const FusionMode fusion);
 
     // persistent values
     cl_context mContext;
     cl_device_id mDevice;
     QMap<cl_context, QMap<cl_device_id, Runtime>> mRuntimes;
     Parameters mParams;
-    QList<QImage> mImages;
+    QStringList mFiles;
 
     // processing values, have to be created if empty, and cleared when device or images change
+    ExecutionPlan mPlan;
     int mPyrHeight;
     size_t mMaxLocalGroupSize;
     size_t mMaxLocalGroupSizeSqrt;
     size_t mMaxLocalGroupSizes[2];
-    QList<QImage> mCachedImages;
+    QSize mFrameSize;
+    QImage::Format mFrameFormat;
+    QList<QImage> mCachedImages; // decoded frames in their native layout, released once resident on the device
+    cl_mem mMemStaging;          // native rows of one frame, imported into mMemSrcImages by krn_import
     QVector<cl_mem> mMemSrcImages;
     QVector<cl_mem> mMemProcessingImgs;
-    QVector<cl_mem> mMemWeights;
-    QVector<cl_mem> mMemResultPyramid;
-    QVector<cl_mem> mMemWeightPyramid;
-    QVector<cl_mem> mMemImagePyramid;
-    QVector<cl_mem> mMemPyrRgbaHalf1;
-    QVector<cl_mem> mMemPyrRgbaHalf2;
-    QVector<QSize> mPyrSizes;
-
+    QVector<cl_mem> mMemWeights;       // mWeightSize each
+    int mWeightLevel;                  // level of mPyrLevels the weights are computed at
+    QSize mWeightSize;                 // size of that level
+    cl_mem mMemWeightSource;           // reduced weights: the frame at mWeightLevel, what krn_weight measures
+    QVector<cl_mem> mMemPyramids;
+    QVector<QRect> mPyrLevels; // level-offset table, shared by all atlases
+    QSize mPyrAtlasSize;
+    int mPyrChannels;          // of pyrFormat(), in the atlases and everything read back from them
+    QVector<cl_mem> mCollapsedLevels; // atlas holding each collapsed result level, valid until the next fuse
+    QVector<cl_mem> mMemFramePyramids; // S_Incremental: laplacian pyramid atlas of every frame
+    QVector<cl_mem> mMemGuidedImgs;    // FM_GuidedFilter: GuidedImage, the pyramids aren't allocated
+    QVector<int> mFrameStages;         // FrameStage flags of every resident frame
+    cl_mem mMemWeightStats;            // resident frames: per work group max and sum of every normalized weight map
+    QVector<cl_float2> mWeightStats;   // host copy of mMemWeightStats
+    QVector<int> mPrunedFrames;        // frames the blend skips, as the recorded blend does
+    cl_mem mMemBlendSum;               // pyramids: blended atlas rows, summed in place by the tiles of every frame
+    cl_mem mMemBlendTiles;             // counts, then the mBlendTileRects indices of the tiles the frame weighs in
+    QVector<cl_int> mBlendTileCounts;  // host copy of the counts: of the frame, blended and offered over the run
+    QVector<cl_int4> mBlendTileRects;  // tiles of every pyramid level: x, y, width, height in the atlas
+    cl_mem mMemBlendTileRects;         // device copy of mBlendTileRects
+    cl_mem mMemChromaSum;              // FM_LumaChroma: blended Cb and Cr at mChromaLevel, RG half rows
+    int mChromaLevel;
+
+    // levels below mPyrLevels are finished on the host, from the smallest device level of every frame;
+    // the buffers are filled in place as the recorded commands point at them
+    QVector<QSize> mHostLevelSizes;              // the smallest device level first
+    QVector< QVector<quint16> > mHostImageLevels;  // half gaussian level of every frame, mPyrChannels per pixel
+    QVector< QVector<quint16> > mHostWeightLevels; // half normalized weight level of every frame, the same way
+    QVector<quint16> mHostResultLevel;             // collapsed blend of the host levels
+
+    // frames of the previous list, by file path, adopted by the next allocation if the frame size stays the same
+    QHash<QString, KeptFrame> mKeptFrames;
+    QSize mKeptFrameSize;
+    QImage::Format mKeptFrameFormat;
+    QVector<QImage> mResultMipmaps;
+
+    QVector<Segment> mDispatchPlan;             // recorded commands of every pass segment, valid as long as the images are
+    QVector<Dispatch> *mRecording;              // segment being recorded, null while replaying
     QVector< QPair<cl_event, QString> > mProfile;
+    QHash<cl_mem, MemAccess> mMemAccesses;
+    QVector<cl_event> mEvents; // every command of the current run, released once it's done
+    QVector<StageEvent> mStageEvents;
+    Stage mStage;              // stage the next commands belong to
+    Statistics mStatistics;
 
     void clearProcessingData();
+    void releaseDeviceData();
+    void keepFrames(const QStringList files);
+    void releaseKeptFrames();
+    void invalidateWeights();
+    QImage::Format resultFormat()const;
 
     QImage assertAndProcess();
+    void specializeWeights(Runtime &runtime);
+    bool readFrameHeaders();
+    bool isAdoptingKeptFrames()const;
+    bool cacheImages();
     bool allocProcessingImages();
-    QImage process(const Runtime runtime, const QSize size);
-    bool createWeightMap(const Runtime runtime, const cl_mem image, const QSize size,
+    bool importResidentImages(const Runtime &runtime);
+    bool prepareFrames(const Runtime &runtime);
+    QImage process(const Runtime &runtime);
+    bool fuse(const Runtime &runtime, const QRect area, const int pass);
+    bool runSegment(const Runtime &runtime, const int segment, const std::function<bool ()> enqueueSegment);
+    bool isPruning()const;
+    bool enqueueWeights(const Runtime &runtime, const QRect area);
+    bool pruneFrames(const Runtime &runtime, const int nextSegment);
+    bool enqueueBlend(const Runtime &runtime, const QRect area);
+    bool finishHostLevels(const Runtime &runtime);
+    bool enqueueCollapse(const Runtime &runtime, const QRect area);
+    bool replay(const Runtime &runtime, QVector<Dispatch> &dispatches);
+    cl_int enqueue(const Runtime &runtime, const Dispatch &dispatch);
+    bool uploadImage(const Runtime &runtime, const int imageIndex, const QRect area, const cl_mem dst);
+    bool createWeightMap(const Runtime &runtime, const cl_mem image, const QSize size,
                          const Parameters params, const cl_mem weightMap);
-    bool normalizeWeights(const Runtime runtime, const QSize size);
-    bool buildGaussPyr(const Runtime runtime, const QSize size, const cl_mem src,
-                       const QVector<cl_mem> pyr, const QVector<cl_mem> tmpPyr);
-    bool buildLaplacePyr(const Runtime runtime, const QVector<cl_mem> pyrSrc, const QVector<cl_mem> pyrDst,
-                         const QVector<cl_mem> pyrTmp1, const QVector<cl_mem> pyrTmp2);
-    bool multiresBlend(const Runtime runtime, const QSize size, const int imageIndex);
-    bool mergeResultPyr(const Runtime runtime);
-    QImage toImage(const Runtime runtime, const QSize size, const cl_mem mem);
-    bool copy(const Runtime runtime, const QSize size, const cl_mem src, const cl_mem dst);
+    bool addWeight(const Runtime &runtime, const QSize size, const int weightIndex);
+    bool divideWeight(const Runtime &runtime, const QSize size, const int weightIndex);
+    bool buildGaussPyr(const Runtime &runtime, const QSize size, const cl_mem src,
+                       const cl_mem pyr, const cl_mem tmpPyr);
+    bool reducePyr(const Runtime &runtime, const cl_mem pyr, const cl_mem tmpPyr, const int level);
+    bool buildWeightPyr(const Runtime &runtime, const cl_mem weight);
+    bool buildLaplacePyr(const Runtime &runtime, const cl_mem pyrSrc, const cl_mem pyrDst,
+                         const cl_mem pyrTmp1, const cl_mem pyrTmp2);
+    bool buildImagePyr(const Runtime &runtime, const QSize size, const cl_mem image, const cl_mem pyr);
+    bool multiresBlend(const Runtime &runtime, const QSize size, const cl_mem image, const cl_mem weight,
+                       const int frame);
+    bool blendPyr(const Runtime &runtime, const QSize size, const cl_mem pyr, const cl_mem weight, const int frame);
+    bool blendChroma(const Runtime &runtime, const cl_mem image);
+    bool guidedBlend(const Runtime &runtime, const QSize size, const cl_mem image, const cl_mem weight);
+    bool boxFilter(const Runtime &runtime, const QSize size, const cl_mem src, const cl_mem dst, const cl_mem tmp,
+                   const int radius);
+    bool transferHostLevel(const Runtime &runtime, const Dispatch::Type type, const cl_mem pyr, quint16 *data);
+    bool mergeResultPyr(const Runtime &runtime);
+    bool convertLevel(const Runtime &runtime, const cl_mem pyr, const QRect level);
+    QImage toImage(const Runtime &runtime, const QSize size, const cl_mem mem);
+    QVector<QImage> readMipmaps(const Runtime &runtime);
+    bool readImage(const Runtime &runtime, const cl_mem mem, const QRect region, QImage &dst, const int dstRow);
+    bool copy(const Runtime &runtime, const QRect region, const cl_mem src, const cl_mem dst);
     void printProfilingInfo();
-    bool filterGauss(const Runtime runtime, const cl_mem src, const cl_mem dst, const cl_mem tmp,
-                     const QSize srcSize, const QSize dstSize,
+    QVector<cl_event> getDependencies(const QVector<cl_mem> reads, const QVector<cl_mem> writes)const;
+    void trackAccess(const QVector<cl_mem> reads, const QVector<cl_mem> writes, const cl_event event);
+    void releaseEvents();
+    void collectStatistics(const Runtime &runtime, const double hostMsecs);
+    bool filterGauss(const Runtime &runtime, const cl_mem src, const cl_mem dst, const cl_mem tmp,
+                     const QRect srcLevel, const QRect dstLevel,
                      const bool downScale, const cl_float4 factor);
 
     template<typename Arg>
-    static cl_int setKernelArg(const cl_kernel kernel, const int argIndex, const Arg arg);
+    static void packArgs(QVector<QByteArray> &blocks, const Arg arg);
+
+    template<typename Arg, typename ... Args>
+    static void packArgs(QVector<QByteArray> &blocks, const Arg arg, const Args ... args);
+
+    template<typename Arg>
+    static void collectMems(QVector<cl_mem> &mems, const Arg arg);
+    static void collectMems(QVector<cl_mem> &mems, const cl_mem mem);
 
     template<typename Arg, typename ... Args>
-    static cl_int setKernelArg(const cl_kernel kernel, const int argIndex, const Arg arg, const Args ... args);
+    static void collectMems(QVector<cl_mem> &mems, const Arg arg, const Args ... args);
+
+    template<typename Arg, typename ... Args>
+    cl_int enqueueKernel(const Runtime &runtime, const KernelType type, const QSize size,
+                         const Arg arg, const Args ... args);
 
     template<typename Arg, typename ... Args>
-    cl_int enqueueKernel(const Runtime runtime, const KernelType type, const QSize size,
+    cl_int enqueueKernel(const Runtime &runtime, const KernelType type, const QRect region,
                          const Arg arg, const Args ... args);
 };
 
+// handles are passed on to the processing thread as they are
+Q_DECLARE_OPAQUE_POINTER(cl_context)
+Q_DECLARE_OPAQUE_POINTER(cl_device_id)
+Q_DECLARE_METATYPE(cl_context)
+Q_DECLARE_METATYPE(cl_device_id)
 Q_DECLARE_METATYPE(MertensCl::Parameters)
+Q_DECLARE_METATYPE(MertensCl::Statistics)
 
 #endif // MERTENSCL_H
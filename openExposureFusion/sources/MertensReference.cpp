@@ -0,0 +1,646 @@
+/*
+OpenCL implementation of the Exposure Fusion
+(algorithm created by Tom Mertens, Jan Kautz, Frank Van Reeth)
+
+Copyright (c) 2015 Alexey Markarov
+
+Permission is hereby granted, free of charge,
+to any person obtaining a copy of this software
+and associated documentation files (the "Software"),
+to deal in the Software without restriction,
+including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice
+shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MertensReference.h"
+#include <cmath>
+
+// the same binomial taps krn_filterGauss applies
+const float kGaussCenter = 0.375f;
+const float kGaussNear = 0.25f;
+const float kGaussFar = 0.0625f;
+
+QVector4D MertensReference::Image::read(const int x, const int y)const
+{
+    // reads outside the image are undefined on the device, they are clamped here
+    const int cx = qBound(0, x, size.width() - 1);
+    const int cy = qBound(0, y, size.height() - 1);
+    return pixels.at(cy * size.width() + cx);
+}
+
+void MertensReference::Image::write(const int x, const int y, const QVector4D value)
+{
+    QVector4D stored;
+    switch(storage)
+    {
+        case SG_Unorm8:
+            stored = QVector4D(roundToUnorm(value.x(), 255.0f), roundToUnorm(value.y(), 255.0f),
+                               roundToUnorm(value.z(), 255.0f), roundToUnorm(value.w(), 255.0f));
+            break;
+        case SG_Unorm16:
+            stored = QVector4D(roundToUnorm(value.x(), 65535.0f), roundToUnorm(value.y(), 65535.0f),
+                               roundToUnorm(value.z(), 65535.0f), roundToUnorm(value.w(), 65535.0f));
+            break;
+        case SG_Half:
+            stored = QVector4D(roundToHalf(value.x()), roundToHalf(value.y()),
+                               roundToHalf(value.z()), roundToHalf(value.w()));
+            break;
+        case SG_RHalf:
+            stored = QVector4D(roundToHalf(value.x()), 0.0f, 0.0f, 1.0f);
+            break;
+    }
+    pixels[y * size.width() + x] = stored;
+}
+
+QImage MertensReference::fuse(const QList<QImage> images, const QSize size, const MertensCl::Parameters params)
+{
+    if(images.isEmpty() || size.isEmpty())
+        return QImage();
+
+    // frames go through the same conversions and the same pyramid geometry as on the device
+    QList<QImage> frames;
+    for(int i = 0; i < images.count(); ++i)
+    {
+        const QImage &img = images.at(i);
+        frames.append((MertensCl::nativeLayout(img.format()) != MertensCl::NL_max)
+                      ? img
+                      : img.convertToFormat(MertensCl::isHighBitDepth(img.format())
+                                            ? QImage::Format_RGBA64
+                                            : QImage::Format_RGBA8888));
+    }
+    const Storage frameStorage = MertensCl::isHighBitDepth(frames) ? SG_Unorm16 : SG_Unorm8;
+    const int height = (params.maxPyrHeight > 0)
+            ? std::min(MertensCl::calcPyrHeight(size), params.maxPyrHeight)
+            : MertensCl::calcPyrHeight(size);
+    QVector<QSize> levels;
+    const QVector<QRect> rects = MertensCl::calcPyrLevels(size, height);
+    for(int l = 0; l < rects.count(); ++l)
+    {
+        levels.append(rects.at(l).size());
+    }
+    if(levels.isEmpty())
+        return QImage();
+
+    //===== Weights and their sum
+    QVector<Image> sources;
+    QVector<Image> weights;
+    Image weightSum(size, SG_RHalf);
+    for(int i = 0; i < frames.count(); ++i)
+    {
+        sources.append(import(frames.at(i), size, frameStorage));
+        weights.append(weightMap(sources.last(), params));
+        weightSum = add(weights.last(), weightSum);
+    }
+
+    //===== Prune the frames whose normalized weight stays below the threshold, the others share their weight
+    QVector<bool> pruned(frames.count(), false);
+    if(params.pruneThreshold > 0.0f)
+    {
+        int prunedCount = 0;
+        for(int i = 0; i < frames.count(); ++i)
+        {
+            const Image normalized = div(weights.at(i), weightSum);
+            float maxWeight = 0.0f;
+            for(int p = 0; p < normalized.pixels.count(); ++p)
+                maxWeight = std::max(maxWeight, normalized.pixels.at(p).x());
+            pruned[i] = (maxWeight < params.pruneThreshold);
+            prunedCount += pruned.at(i) ? 1 : 0;
+        }
+        // as on the device, a threshold that prunes every frame prunes none
+        if(prunedCount == frames.count())
+        {
+            pruned.fill(false);
+            prunedCount = 0;
+        }
+        if(prunedCount > 0)
+        {
+            weightSum = Image(size, SG_RHalf);
+            for(int i = 0; i < frames.count(); ++i)
+            {
+                if(!pruned.at(i))
+                    weightSum = add(weights.at(i), weightSum);
+            }
+        }
+    }
+
+    //===== Blend the laplacian pyramids of the frames by the gaussian pyramids of their normalized weights;
+    // the device levels are blended tile by tile, the levels finished on the host and the top they start from whole
+    const int hostLevels = qBound(0, params.hostPyrLevels, height - 1);
+    const int tiledLevels = (hostLevels > 0) ? height - hostLevels - 1 : height;
+    Pyramid result;
+    for(int l = 0; l < levels.count(); ++l)
+    {
+        result.append(Image(levels.at(l), SG_Half));
+    }
+    for(int i = 0; i < frames.count(); ++i)
+    {
+        if(pruned.at(i))
+            continue;
+        const Pyramid imagePyr = laplacePyr(gaussPyr(sources.at(i), levels));
+        const Pyramid weightPyr = gaussPyr(div(weights.at(i), weightSum), levels);
+        for(int l = 0; l < levels.count(); ++l)
+        {
+            result[l] = (l < tiledLevels)
+                    ? blendTiles(result.at(l), imagePyr.at(l), weightPyr.at(l), params.blendTileWeight)
+                    : blend(result.at(l), imagePyr.at(l), weightPyr.at(l));
+        }
+    }
+
+    return toRgba(collapse(result), params.highBitDepth);
+}
+
+QVector<quint16> MertensReference::blendLevels(const QVector< QVector<quint16> > images,
+                                               const QVector< QVector<quint16> > weights,
+                                               const QVector<QSize> levels, const int channels)
+{
+    if(levels.isEmpty() || images.isEmpty() || (images.count() != weights.count())
+       || ((channels != 1) && (channels != 4)))
+        return QVector<quint16>();
+
+    const QSize size = levels.first();
+    const int count = size.width() * size.height() * channels;
+    const Storage storage = (channels == 1) ? SG_RHalf : SG_Half;
+    const auto toImage = [size, channels, storage](const QVector<quint16> &data) -> Image
+    {
+        Image img(size, storage);
+        for(int i = 0; i < img.pixels.count(); ++i)
+        {
+            img.pixels[i] = (channels == 1)
+                    ? QVector4D(fromHalfBits(data.at(i)), 0.0f, 0.0f, 1.0f)
+                    : QVector4D(fromHalfBits(data.at(i * 4)), fromHalfBits(data.at(i * 4 + 1)),
+                                fromHalfBits(data.at(i * 4 + 2)), fromHalfBits(data.at(i * 4 + 3)));
+        }
+        return img;
+    };
+
+    Pyramid result;
+    for(int l = 0; l < levels.count(); ++l)
+    {
+        result.append(Image(levels.at(l), storage));
+    }
+    for(int i = 0; i < images.count(); ++i)
+    {
+        if((images.at(i).count() != count) || (weights.at(i).count() != count))
+            return QVector<quint16>();
+
+        const Pyramid imagePyr = laplacePyr(gaussPyr(toImage(images.at(i)), levels));
+        const Pyramid weightPyr = gaussPyr(toImage(weights.at(i)), levels);
+        for(int l = 0; l < levels.count(); ++l)
+        {
+            result[l] = blend(result.at(l), imagePyr.at(l), weightPyr.at(l));
+        }
+    }
+
+    const Image collapsed = collapse(result);
+    QVector<quint16> data(count);
+    for(int i = 0; i < collapsed.pixels.count(); ++i)
+    {
+        const QVector4D &c = collapsed.pixels.at(i);
+        if(channels == 1)
+        {
+            data[i] = toHalfBits(c.x());
+            continue;
+        }
+        data[i * 4] = toHalfBits(c.x());
+        data[i * 4 + 1] = toHalfBits(c.y());
+        data[i * 4 + 2] = toHalfBits(c.z());
+        data[i * 4 + 3] = toHalfBits(c.w());
+    }
+    return data;
+}
+
+double MertensReference::psnr(const QImage a, const QImage b)
+{
+    if(a.size() != b.size() || a.isNull())
+        return 0.0;
+
+    const QImage a64 = a.convertToFormat(QImage::Format_RGBA64);
+    const QImage b64 = b.convertToFormat(QImage::Format_RGBA64);
+    double squares = 0.0;
+    for(int y = 0; y < a64.height(); ++y)
+    {
+        const quint16 *lineA = reinterpret_cast<const quint16*>(a64.constScanLine(y));
+        const quint16 *lineB = reinterpret_cast<const quint16*>(b64.constScanLine(y));
+        for(int x = 0; x < a64.width(); ++x)
+        {
+            for(int c = 0; c < 3; ++c)
+            {
+                const double diff = (lineA[x * 4 + c] - lineB[x * 4 + c]) / 65535.0;
+                squares += diff * diff;
+            }
+        }
+    }
+    const double mse = squares / (3.0 * a64.width() * a64.height());
+    return (mse > 0.0) ? 10.0 * std::log10(1.0 / mse) : std::numeric_limits<double>::infinity();
+}
+
+double MertensReference::maxError(const QImage a, const QImage b)
+{
+    if(a.size() != b.size() || a.isNull())
+        return 1.0;
+
+    const QImage a64 = a.convertToFormat(QImage::Format_RGBA64);
+    const QImage b64 = b.convertToFormat(QImage::Format_RGBA64);
+    int maxDiff = 0;
+    for(int y = 0; y < a64.height(); ++y)
+    {
+        const quint16 *lineA = reinterpret_cast<const quint16*>(a64.constScanLine(y));
+        const quint16 *lineB = reinterpret_cast<const quint16*>(b64.constScanLine(y));
+        for(int x = 0; x < a64.width(); ++x)
+        {
+            for(int c = 0; c < 3; ++c)
+            {
+                maxDiff = std::max(maxDiff, std::abs(lineA[x * 4 + c] - lineB[x * 4 + c]));
+            }
+        }
+    }
+    return maxDiff / 65535.0;
+}
+
+int MertensReference::borderCoord(int coord, const int maxCoord)
+{
+    // same integer mirroring as borderCoord() in mertens.cl
+    coord = std::abs(coord);
+    const int minValue = maxCoord * 2 - coord;
+    return minValue + (coord - minValue) * std::max(std::min(maxCoord - coord, 1), 0);
+}
+
+float MertensReference::roundToHalf(const float value)
+{
+    // binary16 rounded to the nearest even, as write_imagef stores CL_HALF_FLOAT
+    if(std::isnan(value))
+        return value;
+    const float absValue = std::fabs(value);
+    if(absValue >= 65520.0f)
+        return std::copysign(std::numeric_limits<float>::infinity(), value);
+    if(absValue < 6.103515625e-05f) // subnormals have a fixed step of 2^-24
+        return std::copysign(std::nearbyint(absValue * 16777216.0f) / 16777216.0f, value);
+
+    int exponent = 0;
+    std::frexp(absValue, &exponent);
+    const float step = std::ldexp(1.0f, exponent - 11);
+    return std::copysign(std::nearbyint(absValue / step) * step, value);
+}
+
+float MertensReference::fromHalfBits(const quint16 bits)
+{
+    const float sign = (bits & 0x8000) ? -1.0f : 1.0f;
+    const int exponent = (bits >> 10) & 0x1f;
+    const int mantissa = bits & 0x3ff;
+    if(exponent == 0x1f)
+        return mantissa ? std::numeric_limits<float>::quiet_NaN() : sign * std::numeric_limits<float>::infinity();
+    if(exponent == 0)
+        return sign * std::ldexp(static_cast<float>(mantissa), -24);
+    return sign * std::ldexp(static_cast<float>(mantissa | 0x400), exponent - 25);
+}
+
+quint16 MertensReference::toHalfBits(const float value)
+{
+    const float rounded = roundToHalf(value);
+    const quint16 sign = std::signbit(rounded) ? 0x8000 : 0;
+    const float absValue = std::fabs(rounded);
+    if(std::isnan(absValue))
+        return sign | 0x7e00;
+    if(std::isinf(absValue))
+        return sign | 0x7c00;
+    if(absValue < 6.103515625e-05f)
+        return sign | static_cast<quint16>(absValue * 16777216.0f);
+
+    int exponent = 0;
+    const float mantissa = std::frexp(absValue, &exponent);
+    return sign | static_cast<quint16>((exponent + 14) << 10) | static_cast<quint16>((mantissa * 2.0f - 1.0f) * 1024.0f);
+}
+
+float MertensReference::roundToUnorm(const float value, const float maxValue)
+{
+    // convert_*_sat_rte() of the scaled value, NaNs become 0
+    if(std::isnan(value))
+        return 0.0f;
+    return std::nearbyint(qBound(0.0f, value * maxValue, maxValue)) / maxValue;
+}
+
+float MertensReference::weightTerm(const float measure, const float exponent)
+{
+    // krn_weight is specialized the same way: skipped for 0, taken as it is for 1, raised otherwise
+    if(exponent == 0.0f)
+        return 1.0f;
+    return (exponent == 1.0f) ? measure : std::pow(measure, exponent);
+}
+
+QVector4D MertensReference::readNative(const QImage &image, const int x, const int y)
+{
+    const uchar *row = image.constScanLine(y);
+    switch(MertensCl::nativeLayout(image.format()))
+    {
+        case MertensCl::NL_Rgb888:
+            return QVector4D(row[x * 3], row[x * 3 + 1], row[x * 3 + 2], 255.0f) * (1.0f / 255.0f);
+        case MertensCl::NL_Bgra8888:
+            return QVector4D(row[x * 4 + 2], row[x * 4 + 1], row[x * 4], row[x * 4 + 3]) * (1.0f / 255.0f);
+        case MertensCl::NL_Rgba16:
+        {
+            const quint16 *row16 = reinterpret_cast<const quint16*>(row);
+            return QVector4D(row16[x * 4], row16[x * 4 + 1], row16[x * 4 + 2], row16[x * 4 + 3]) * (1.0f / 65535.0f);
+        }
+        case MertensCl::NL_Gray8:
+        {
+            const float gray = row[x] * (1.0f / 255.0f);
+            return QVector4D(gray, gray, gray, 1.0f);
+        }
+        default:
+            return QVector4D(row[x * 4], row[x * 4 + 1], row[x * 4 + 2], row[x * 4 + 3]) * (1.0f / 255.0f);
+    }
+}
+
+MertensReference::Image MertensReference::import(const QImage &image, const QSize size, const Storage storage)
+{
+    // every pixel averages the native pixels it covers, weighted by the covered area, as krn_import does
+    Image dst(size, storage);
+    const float scaleX = static_cast<float>(image.width()) / size.width();
+    const float scaleY = static_cast<float>(image.height()) / size.height();
+    for(int y = 0; y < size.height(); ++y)
+    {
+        const float fromY = y * scaleY;
+        const float toY = fromY + scaleY;
+        const int firstY = static_cast<int>(std::floor(fromY));
+        const int lastY = std::min(static_cast<int>(std::ceil(toY)) - 1, image.height() - 1);
+        for(int x = 0; x < size.width(); ++x)
+        {
+            const float fromX = x * scaleX;
+            const float toX = fromX + scaleX;
+            const int firstX = static_cast<int>(std::floor(fromX));
+            const int lastX = std::min(static_cast<int>(std::ceil(toX)) - 1, image.width() - 1);
+
+            QVector4D sum;
+            float weightSum = 0.0f;
+            for(int sy = firstY; sy <= lastY; ++sy)
+            {
+                const float wy = std::min(toY, static_cast<float>(sy + 1)) - std::max(fromY, static_cast<float>(sy));
+                for(int sx = firstX; sx <= lastX; ++sx)
+                {
+                    const float w = wy * (std::min(toX, static_cast<float>(sx + 1)) - std::max(fromX, static_cast<float>(sx)));
+                    sum += readNative(image, sx, sy) * w;
+                    weightSum += w;
+                }
+            }
+            dst.write(x, y, sum * (1.0f / weightSum));
+        }
+    }
+    return dst;
+}
+
+MertensReference::Image MertensReference::weightMap(const Image &image, const MertensCl::Parameters params)
+{
+    // the exposedness lookup table of 8 bits frames holds the very values computed here
+    const QSize size = image.size;
+    const int maxX = size.width() - 1;
+    const int maxY = size.height() - 1;
+    const auto gray = [](const QVector4D c) { return c.x() * 0.299f + c.y() * 0.587f + c.z() * 0.114f; };
+    Image weight(size, SG_RHalf);
+    for(int y = 0; y < size.height(); ++y)
+    {
+        for(int x = 0; x < size.width(); ++x)
+        {
+            const QVector4D c = image.read(x, y);
+            const float contrast = std::fabs(gray(c) * -4.0f
+                                             + gray(image.read(borderCoord(x, maxX), borderCoord(y - 1, maxY)))
+                                             + gray(image.read(borderCoord(x - 1, maxX), borderCoord(y, maxY)))
+                                             + gray(image.read(borderCoord(x + 1, maxX), borderCoord(y, maxY)))
+                                             + gray(image.read(borderCoord(x, maxX), borderCoord(y + 1, maxY))));
+
+            const float mean = c.x() * 0.3333333333f + c.y() * 0.3333333333f + c.z() * 0.3333333333f;
+            const QVector3D spread(c.x() - mean, c.y() - mean, c.z() - mean);
+            const float saturation = std::sqrt(QVector3D::dotProduct(spread, spread));
+
+            const QVector3D d(c.x() - 0.5f, c.y() - 0.5f, c.z() - 0.5f);
+            const float exposedness = (-(d.x() * d.x()) * 12.5f) * (-(d.y() * d.y()) * 12.5f) * (-(d.z() * d.z()) * 12.5f);
+
+            const float w = weightTerm(contrast, params.contrast)
+                            * weightTerm(saturation, params.saturation)
+                            * weightTerm(exposedness, params.exposedness);
+            weight.write(x, y, QVector4D(w, w, w, w));
+        }
+    }
+    return weight;
+}
+
+MertensReference::Image MertensReference::add(const Image &a, const Image &b)
+{
+    Image dst(a.size, a.storage);
+    for(int y = 0; y < a.size.height(); ++y)
+        for(int x = 0; x < a.size.width(); ++x)
+            dst.write(x, y, a.read(x, y) + b.read(x, y));
+    return dst;
+}
+
+MertensReference::Image MertensReference::sub(const Image &a, const Image &b)
+{
+    Image dst(a.size, a.storage);
+    for(int y = 0; y < a.size.height(); ++y)
+        for(int x = 0; x < a.size.width(); ++x)
+            dst.write(x, y, a.read(x, y) - b.read(x, y));
+    return dst;
+}
+
+MertensReference::Image MertensReference::blend(const Image &sum, const Image &a, const Image &weight)
+{
+    // krn_blendTiles rounds the weighted value and the sum once
+    Image dst(sum.size, sum.storage);
+    for(int y = 0; y < sum.size.height(); ++y)
+        for(int x = 0; x < sum.size.width(); ++x)
+            dst.write(x, y, sum.read(x, y) + a.read(x, y) * weight.read(x, y).x());
+    return dst;
+}
+
+MertensReference::Image MertensReference::blendTiles(const Image &sum, const Image &a, const Image &weight,
+                                                     const float threshold)
+{
+    // krn_tileList: the tiles of the level the weight stays below the threshold in are left as they are
+    const int tileSize = MertensCl::sBlendTileSize;
+    const Image blended = blend(sum, a, weight);
+    Image dst = sum;
+    for(int ty = 0; ty < sum.size.height(); ty += tileSize)
+    {
+        for(int tx = 0; tx < sum.size.width(); tx += tileSize)
+        {
+            const int right = std::min(tx + tileSize, sum.size.width());
+            const int bottom = std::min(ty + tileSize, sum.size.height());
+            float maxWeight = 0.0f;
+            for(int y = ty; y < bottom; ++y)
+                for(int x = tx; x < right; ++x)
+                    maxWeight = std::max(maxWeight, weight.read(x, y).x());
+            if(maxWeight < threshold)
+                continue;
+            for(int y = ty; y < bottom; ++y)
+                for(int x = tx; x < right; ++x)
+                    dst.write(x, y, blended.read(x, y));
+        }
+    }
+    return dst;
+}
+
+MertensReference::Image MertensReference::div(const Image &dividend, const Image &divisor)
+{
+    // OpenCL clamp() is fmin(fmax()), so a zero sum clamps to 0 rather than passing the NaN on
+    Image dst(dividend.size, dividend.storage);
+    for(int y = 0; y < dividend.size.height(); ++y)
+    {
+        for(int x = 0; x < dividend.size.width(); ++x)
+        {
+            const QVector4D q = dividend.read(x, y) / divisor.read(x, y);
+            dst.write(x, y, QVector4D(std::fmin(std::fmax(q.x(), 0.0f), 1.0f),
+                                      std::fmin(std::fmax(q.y(), 0.0f), 1.0f),
+                                      std::fmin(std::fmax(q.z(), 0.0f), 1.0f),
+                                      std::fmin(std::fmax(q.w(), 0.0f), 1.0f)));
+        }
+    }
+    return dst;
+}
+
+MertensReference::Image MertensReference::convert(const Image &image, const Storage storage)
+{
+    Image dst(image.size, storage);
+    for(int y = 0; y < image.size.height(); ++y)
+        for(int x = 0; x < image.size.width(); ++x)
+            dst.write(x, y, image.read(x, y));
+    return dst;
+}
+
+MertensReference::Image MertensReference::upsample(const Image &small, const QSize bigSize)
+{
+    // even pixels take the small level, the odd ones are zeroed
+    Image big(bigSize, small.storage);
+    for(int y = 0; y < bigSize.height(); ++y)
+        for(int x = 0; x < bigSize.width(); ++x)
+            big.write(x, y, ((x % 2) || (y % 2)) ? QVector4D() : small.read(x / 2, y / 2));
+    return big;
+}
+
+MertensReference::Image MertensReference::filterGauss(const Image &src, const QSize dstSize,
+                                                      const bool downScale, const float factor)
+{
+    // separable binomial filter, the horizontal pass is stored in between like on the device
+    const int maxX = src.size.width() - 1;
+    const int maxY = src.size.height() - 1;
+    Image tmp(src.size, SG_Half);
+    for(int y = 0; y < src.size.height(); ++y)
+    {
+        for(int x = 0; x < src.size.width(); ++x)
+        {
+            const QVector4D color = src.read(x, y) * kGaussCenter
+                    + src.read(borderCoord(x + 1, maxX), borderCoord(y, maxY)) * kGaussNear
+                    + src.read(borderCoord(x - 1, maxX), borderCoord(y, maxY)) * kGaussNear
+                    + src.read(borderCoord(x + 2, maxX), borderCoord(y, maxY)) * kGaussFar
+                    + src.read(borderCoord(x - 2, maxX), borderCoord(y, maxY)) * kGaussFar;
+            tmp.write(x, y, color);
+        }
+    }
+
+    const int step = downScale ? 2 : 1;
+    Image dst(dstSize, SG_Half);
+    for(int y = 0; y < dstSize.height(); ++y)
+    {
+        for(int x = 0; x < dstSize.width(); ++x)
+        {
+            const int sx = x * step;
+            const int sy = y * step;
+            const QVector4D color = tmp.read(borderCoord(sx, maxX), borderCoord(sy, maxY)) * kGaussCenter
+                    + tmp.read(borderCoord(sx, maxX), borderCoord(sy + 1, maxY)) * kGaussNear
+                    + tmp.read(borderCoord(sx, maxX), borderCoord(sy - 1, maxY)) * kGaussNear
+                    + tmp.read(borderCoord(sx, maxX), borderCoord(sy + 2, maxY)) * kGaussFar
+                    + tmp.read(borderCoord(sx, maxX), borderCoord(sy - 2, maxY)) * kGaussFar;
+            dst.write(x, y, color * factor);
+        }
+    }
+    return dst;
+}
+
+MertensReference::Pyramid MertensReference::gaussPyr(const Image &image, const QVector<QSize> levels)
+{
+    Pyramid pyr;
+    pyr.append(convert(image, SG_Half));
+    for(int i = 1; i < levels.count(); ++i)
+    {
+        pyr.append(filterGauss(pyr.last(), levels.at(i), true, 1.0f));
+    }
+    return pyr;
+}
+
+MertensReference::Pyramid MertensReference::laplacePyr(const Pyramid &gauss)
+{
+    Pyramid pyr;
+    for(int i = 0; i < (gauss.count() - 1); ++i)
+    {
+        const QSize bigSize = gauss.at(i).size;
+        pyr.append(sub(gauss.at(i), filterGauss(upsample(gauss.at(i + 1), bigSize), bigSize, false, 4.0f)));
+    }
+    pyr.append(gauss.last());
+    return pyr;
+}
+
+MertensReference::Image MertensReference::collapse(const Pyramid &pyr)
+{
+    Image collapsed = pyr.last();
+    for(int i = (pyr.count() - 1); i > 0; --i)
+    {
+        const QSize bigSize = pyr.at(i - 1).size;
+        collapsed = add(pyr.at(i - 1), filterGauss(upsample(collapsed, bigSize), bigSize, false, 4.0f));
+    }
+    return collapsed;
+}
+
+QImage MertensReference::toRgba(const Image &image, const bool highBitDepth)
+{
+    // krn_toRgba clamps to the displayable range with an opaque alpha
+    Image rgba(image.size, highBitDepth ? SG_Unorm16 : SG_Unorm8);
+    for(int y = 0; y < image.size.height(); ++y)
+    {
+        for(int x = 0; x < image.size.width(); ++x)
+        {
+            const QVector4D c = image.read(x, y);
+            rgba.write(x, y, QVector4D(std::fmin(std::fmax(c.x(), 0.0f), 1.0f),
+                                       std::fmin(std::fmax(c.y(), 0.0f), 1.0f),
+                                       std::fmin(std::fmax(c.z(), 0.0f), 1.0f),
+                                       1.0f));
+        }
+    }
+
+    QImage img(image.size, highBitDepth ? QImage::Format_RGBA64 : QImage::Format_RGB32);
+    for(int y = 0; y < img.height(); ++y)
+    {
+        uchar *line = img.scanLine(y);
+        for(int x = 0; x < img.width(); ++x)
+        {
+            const QVector4D c = rgba.read(x, y);
+            if(highBitDepth)
+            {
+                reinterpret_cast<QRgba64*>(line)[x] = QRgba64::fromRgba64(qRound(c.x() * 65535.0f),
+                                                                          qRound(c.y() * 65535.0f),
+                                                                          qRound(c.z() * 65535.0f),
+                                                                          65535);
+            }
+            else
+            {
+                reinterpret_cast<QRgb*>(line)[x] = qRgb(qRound(c.x() * 255.0f),
+                                                         qRound(c.y() * 255.0f),
+                                                         qRound(c.z() * 255.0f));
+            }
+        }
+    }
+    return img;
+}
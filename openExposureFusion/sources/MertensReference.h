@@ -0,0 +1,107 @@
+/*
+OpenCL implementation of the Exposure Fusion
+(algorithm created by Tom Mertens, Jan Kautz, Frank Van Reeth)
+
+Copyright (c) 2015 Alexey Markarov
+
+Permission is hereby granted, free of charge,
+to any person obtaining a copy of this software
+and associated documentation files (the "Software"),
+to deal in the Software without restriction,
+including without limitation the rights to use, copy,
+modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software,
+and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice
+shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MERTENSREFERENCE_H
+#define MERTENSREFERENCE_H
+
+#include <QtCore>
+#include <QtGui>
+#include "MertensCl.h"
+
+// scalar host implementation of the mertens.cl fusion, the device results are validated against it;
+// every intermediate image is rounded to the format the device stores it in
+class MertensReference
+{
+public:
+    static QImage fuse(const QList<QImage> images, const QSize size, const MertensCl::Parameters params);
+    static double psnr(const QImage a, const QImage b);      // dB over the color channels, infinite when equal
+    static double maxError(const QImage a, const QImage b);  // biggest channel difference, 1 is the full range
+
+    // finishes the pyramid below the smallest device level: 'images' and 'weights' hold that level of the gaussian
+    // pyramid and of the normalized weight pyramid of every frame as half floats, 'channels' per pixel (4 or 1 for
+    // the luma), 'levels' are the sizes from it down; returns the collapsed blend of these levels the same way
+    static QVector<quint16> blendLevels(const QVector< QVector<quint16> > images,
+                                        const QVector< QVector<quint16> > weights,
+                                        const QVector<QSize> levels, const int channels = 4);
+
+private:
+    enum Storage
+    {
+        SG_Unorm8 = 0,
+        SG_Unorm16,
+        SG_Half,
+        SG_RHalf    // single channel, read as (r, 0, 0, 1)
+    };
+
+    class Image
+    {
+    public:
+        QSize size;
+        Storage storage;
+        QVector<QVector4D> pixels;
+
+        Image(const QSize s = QSize(), const Storage st = SG_Half)
+            : size(s), storage(st), pixels(s.width() * s.height())
+        { }
+
+        QVector4D read(const int x, const int y)const;
+        void write(const int x, const int y, const QVector4D value);
+    };
+
+    typedef QVector<Image> Pyramid;
+
+    static int borderCoord(int coord, const int maxCoord);
+    static float roundToHalf(const float value);
+    static float fromHalfBits(const quint16 bits);
+    static quint16 toHalfBits(const float value);
+    static float roundToUnorm(const float value, const float maxValue);
+    static float weightTerm(const float measure, const float exponent);
+
+    static QVector4D readNative(const QImage &image, const int x, const int y);
+    static Image import(const QImage &image, const QSize size, const Storage storage);
+    static Image weightMap(const Image &image, const MertensCl::Parameters params);
+    static Image add(const Image &a, const Image &b);
+    static Image sub(const Image &a, const Image &b);
+    static Image blend(const Image &sum, const Image &a, const Image &weight);
+    static Image blendTiles(const Image &sum, const Image &a, const Image &weight, const float threshold);
+    static Image div(const Image &dividend, const Image &divisor);
+    static Image convert(const Image &image, const Storage storage);
+    static Image upsample(const Image &small, const QSize bigSize);
+    static Image filterGauss(const Image &src, const QSize dstSize, const bool downScale, const float factor);
+    static Pyramid gaussPyr(const Image &image, const QVector<QSize> levels);
+    static Pyramid laplacePyr(const Pyramid &gauss);
+    static Image collapse(const Pyramid &pyr);
+    static QImage toRgba(const Image &image, const bool highBitDepth);
+
+    MertensReference();
+    ~MertensReference();
+};
+
+#endif // MERTENSREFERENCE_H
@@ -25,6 +25,12 @@ const QMap<Settings::Type, Settings::TypeInfo> Settings::sTypes = {
     {Settings::T_MeasureExposedness,    Settings::TypeInfo("MeasureExposedness",    0)},
     {Settings::T_OutputFormat,          Settings::TypeInfo("OutputFormat",          QString())},
     {Settings::T_OutputDir,             Settings::TypeInfo("OutputDir",             QString())},
+    {Settings::T_ImageCacheSize,        Settings::TypeInfo("ImageCacheSize",        1024)},
+    {Settings::T_PyramidMaxHeight,      Settings::TypeInfo("PyramidMaxHeight",      0)},
+    {Settings::T_HostPyramidLevels,     Settings::TypeInfo("HostPyramidLevels",     0)},
+    {Settings::T_FusionMode,            Settings::TypeInfo("FusionMode",            0)},
+    {Settings::T_PruneThreshold,        Settings::TypeInfo("PruneThreshold",        0)},
+    {Settings::T_WeightLevel,           Settings::TypeInfo("WeightLevel",           0)},
 };
 
 void Settings::set(const Type t, const QVariant value)
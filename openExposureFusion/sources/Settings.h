@@ -32,6 +32,12 @@ public:
         T_MeasureExposedness,
         T_OutputFormat,
         T_OutputDir,
+        T_ImageCacheSize,       // MiB of decoded source images kept in memory
+        T_PyramidMaxHeight,     // pyramid levels at most, 0 for no cap
+        T_HostPyramidLevels,    // smallest pyramid levels finished on the host
+        T_FusionMode,           // MertensCl::FusionMode, the approximations trade quality for speed
+        T_PruneThreshold,       // frames with a smaller normalized weight everywhere are skipped, 0 keeps all
+        T_WeightLevel,          // pyramid level the weights are computed at, 0 for full size, up to 2
         T_max
     };
 
@@ -103,15 +103,6 @@ QString Util::toStatusString(const cl_build_status status)
     return map.value(status, QObject::tr("undefined"));
 }
 
-void Util::release(const QVector<cl_mem> objects)
-{
-    for(int i = 0; i < objects.count(); ++i)
-    {
-        const cl_mem obj = objects.at(i);
-        clReleaseMemObject(obj);
-    }
-}
-
 QString Util::toString(const cl_image_format format)
 {
     static const QMap<cl_channel_order, QString> channelsMap = {
@@ -29,7 +29,6 @@ public:
     static QString toString(const cl_int err);
     static QString toStatusString(const cl_build_status status);
     static QString toString(const cl_image_format format);
-    static void release(const QVector<cl_mem> objects);
     static qint64 byteCount(const QSize size, const cl_image_format format);
     static size_t addPadding(const size_t num, const size_t pad);
 
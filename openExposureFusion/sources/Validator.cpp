@@ -0,0 +1,179 @@
+/*
+openExposureFusion
+Copyright (C) 2015 Alexey Markarov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Validator.h"
+#include "MertensCl.h"
+#include "MertensReference.h"
+#include "Settings.h"
+#include "wrappersCL/ClPlatform.h"
+
+const double Validator::kMinPsnr = 40.0;           // dB
+const double Validator::kMaxError = 4.0 / 255.0;    // relaxed math and half floats may move a few 8 bits steps
+const int Validator::kHostPyrLevels = 2;
+const float Validator::kPruneThreshold = 0.05f;     // prunes frames that barely weigh anywhere
+
+int Validator::run(const QStringList files)
+{
+    QTextStream out(stdout);
+    if(files.isEmpty())
+    {
+        out << "usage: --validate <image> <image> ..." << endl;
+        return 2;
+    }
+    if(clewInit(L"OpenCL") != CLEW_SUCCESS)
+    {
+        out << "can't connect to OpenCL" << endl;
+        return 2;
+    }
+
+    // the CPU devices are the reference platform, any other usable device is taken when there is none
+    QList<ClDevice> cpuDevices;
+    QList<ClDevice> otherDevices;
+    const QList<ClPlatform> platforms = ClPlatform::getPlatforms();
+    for(int ipl = 0; ipl < platforms.count(); ++ipl)
+    {
+        const QList<ClDevice> devices = platforms.at(ipl).getDevices();
+        for(int idev = 0; idev < devices.count(); ++idev)
+        {
+            const ClDevice device = devices.at(idev);
+            if(!device.isAvailable() || !device.isCompilerAvailable() || !device.areImagesSupported())
+                continue;
+            if(device.getType() == CL_DEVICE_TYPE_CPU)
+                cpuDevices.append(device);
+            else
+                otherDevices.append(device);
+        }
+    }
+    const QList<ClDevice> devices = cpuDevices.isEmpty() ? otherDevices : cpuDevices;
+    if(devices.isEmpty())
+    {
+        out << "no usable OpenCL device" << endl;
+        return 2;
+    }
+
+    QList<QImage> images;
+    for(int i = 0; i < files.count(); ++i)
+    {
+        const QImage img(files.at(i));
+        if(img.isNull())
+        {
+            out << "can't load " << files.at(i) << endl;
+            return 2;
+        }
+        images.append(img);
+    }
+
+    MertensCl::Parameters params;
+    params.contrast = Settings::getDefault(Settings::T_MeasureContrast).toFloat();
+    params.saturation = Settings::getDefault(Settings::T_MeasureSaturation).toFloat();
+    params.exposedness = Settings::getDefault(Settings::T_MeasureExposedness).toFloat();
+    params.highBitDepth = false;
+    params.mipmapsAbove = 0;
+    params.maxPyrHeight = Settings::getDefault(Settings::T_PyramidMaxHeight).toInt();
+    params.hostPyrLevels = 0;
+    params.fusion = MertensCl::FM_Pyramid; // the reference implements the pyramids only
+    params.pruneThreshold = 0.0f;
+    params.weightLevel = 0;                // with full size weights
+    for(int i = 0; i < images.count(); ++i)
+    {
+        params.highBitDepth |= MertensCl::isHighBitDepth(images.at(i).format());
+    }
+
+    QVector<cl_context> contexts;
+    for(int i = 0; i < devices.count(); ++i)
+        contexts.append(devices.at(i).getContext());
+    MertensCl fusion;
+    if(!fusion.init(contexts))
+    {
+        out << "can't initialize OpenCL" << endl;
+        return 2;
+    }
+    MertensCl::Statistics statistics;
+    QObject::connect(&fusion, &MertensCl::statisticsChanged,
+                     [&statistics](const MertensCl::Statistics s) { statistics = s; });
+
+    // every strategy is forced in turn, then every option is toggled on the first plan that fits
+    static const QStringList strategies = {"incremental", "resident", "streaming", "tiled"};
+    QList< QPair<QString, MertensCl::Parameters> > runs;
+    for(int s = 0; s < MertensCl::S_max; ++s)
+    {
+        MertensCl::Parameters strategyParams = params;
+        strategyParams.firstStrategy = static_cast<MertensCl::Strategy>(s);
+        runs.append(qMakePair(strategies.at(s), strategyParams));
+    }
+    MertensCl::Parameters hostLevelsParams = params;
+    hostLevelsParams.hostPyrLevels = kHostPyrLevels;
+    runs.append(qMakePair(QString("host levels"), hostLevelsParams));
+    MertensCl::Parameters pruneParams = params;
+    pruneParams.pruneThreshold = kPruneThreshold;
+    runs.append(qMakePair(QString("pruning"), pruneParams));
+    MertensCl::Parameters allTilesParams = params;
+    allTilesParams.blendTileWeight = 0.0f;
+    runs.append(qMakePair(QString("every tile"), allTilesParams));
+
+    bool isPassed = true;
+    for(int i = 0; i < devices.count(); ++i)
+    {
+        const ClDevice device = devices.at(i);
+        for(int r = 0; r < runs.count(); ++r)
+        {
+            const QString name = device.getName() + " " + runs.at(r).first;
+            const MertensCl::Parameters &runParams = runs.at(r).second;
+            statistics = MertensCl::Statistics();
+            const QImage result = fusion.process(device.getContext(), device.getId(), files, runParams);
+            if(result.isNull())
+            {
+                out << name << ": fusion failed" << endl;
+                isPassed = false;
+                continue;
+            }
+            // a strategy that doesn't fit falls back to the next one, which is checked on its own
+            if((r < MertensCl::S_max) && (statistics.strategy != runParams.firstStrategy))
+            {
+                out << name << ": no plan fits, skipped" << endl;
+                continue;
+            }
+
+            // the reference follows the size and the depth the device chose, and prunes only measured frames,
+            // so only the math is compared
+            MertensCl::Parameters referenceParams = runParams;
+            referenceParams.maxPyrHeight = statistics.pyrHeight;
+            referenceParams.pruneThreshold = statistics.weightMax.isEmpty() ? 0.0f : runParams.pruneThreshold;
+            QElapsedTimer timer;
+            timer.start();
+            const QImage reference = MertensReference::fuse(images, result.size(), referenceParams);
+            const double referenceMsecs = timer.nsecsElapsed() / 1e6;
+
+            const double psnr = MertensReference::psnr(result, reference);
+            const double maxError = MertensReference::maxError(result, reference);
+            const bool isRunPassed = (psnr >= kMinPsnr) && (maxError <= kMaxError);
+            isPassed &= isRunPassed;
+            out << name
+                << ": " << result.width() << "x" << result.height()
+                << ", strategy " << strategies.value(statistics.strategy)
+                << ", pruned " << statistics.prunedFiles.count() << "/" << statistics.frames
+                << ", blended tiles " << statistics.blendedTiles << "/" << statistics.blendTiles
+                << ", device " << QString::number(statistics.hostMsecs, 'f', 2) << " ms"
+                << ", reference " << QString::number(referenceMsecs, 'f', 2) << " ms"
+                << ", PSNR " << QString::number(psnr, 'f', 2) << " dB"
+                << ", max error " << QString::number(maxError * 255.0, 'f', 2) << "/255"
+                << (isRunPassed ? " - passed" : " - FAILED") << endl;
+        }
+    }
+    return isPassed ? 0 : 1;
+}
@@ -0,0 +1,41 @@
+/*
+openExposureFusion
+Copyright (C) 2015 Alexey Markarov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VALIDATOR_H
+#define VALIDATOR_H
+
+#include <QtCore>
+
+// runs the fusion on the OpenCL CPU devices and compares the results with MertensReference,
+// the exit code tells whether every device stayed within the tolerance
+class Validator
+{
+public:
+    static int run(const QStringList files);
+
+private:
+    static const double kMinPsnr;
+    static const double kMaxError;
+    static const int kHostPyrLevels;
+    static const float kPruneThreshold;
+
+    Validator();
+    ~Validator();
+};
+
+#endif // VALIDATOR_H
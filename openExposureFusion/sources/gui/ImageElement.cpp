@@ -18,11 +18,54 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "ImageElement.h"
 
+// owns the texture, so it's released on the render thread along with the node
+class ImageElementNode : public QSGGeometryNode
+{
+public:
+    ImageElementNode()
+        : mGeometry(QSGGeometry::defaultAttributes_TexturedPoint2D(), 4)
+    {
+        mMaterial.setFiltering(QSGTexture::Linear);
+        mMaterial.setMipmapFiltering(QSGTexture::Linear);
+        mOpaqueMaterial.setFiltering(QSGTexture::Linear);
+        mOpaqueMaterial.setMipmapFiltering(QSGTexture::Linear);
+        setGeometry(&mGeometry);
+        setMaterial(&mOpaqueMaterial);
+    }
+
+    ~ImageElementNode()
+    {
+        delete mMaterial.texture();
+    }
+
+    void setTexture(QSGTexture *texture)
+    {
+        delete mMaterial.texture();
+        mMaterial.setTexture(texture);
+        mOpaqueMaterial.setTexture(texture);
+        setMaterial(texture->hasAlphaChannel() ? &mMaterial : &mOpaqueMaterial);
+        markDirty(DirtyMaterial);
+    }
+
+    void setRect(const QRectF &rect)
+    {
+        QSGGeometry::updateTexturedRectGeometry(&mGeometry, rect, QRectF(0, 0, 1, 1));
+        markDirty(DirtyGeometry);
+    }
+
+private:
+    QSGGeometry mGeometry;
+    QSGTextureMaterial mMaterial;
+    QSGOpaqueTextureMaterial mOpaqueMaterial; // fusion results are always opaque, no blending needed
+};
+
 ImageElement::ImageElement(QQuickItem *parent)
-    : QQuickPaintedItem(parent)
+    : QQuickItem(parent)
     , mAlignment(Qt::AlignCenter)
+    , mMaxTextureSize(0)
+    , mIsTextureDirty(false)
 {
-    setFillColor(Qt::transparent);
+    setFlag(ItemHasContents, true);
 }
 
 ImageElement::~ImageElement()
@@ -34,33 +77,107 @@ QImage ImageElement::getImage()const
     return mMipmaps.isEmpty() ? QImage() : mMipmaps.first();
 }
 
+int ImageElement::getMaxTextureSize()const
+{
+    return mMaxTextureSize;
+}
+
 void ImageElement::setImage(const QImage img)
 {
+    setMipmappedImage(img, QVariantList());
+}
+
+void ImageElement::setMipmappedImage(const QImage img, const QVariantList mipmaps)
+{
+    // prebuilt levels are kept as long as they continue the chain,
+    // the GPU builds its own mipmaps, these only serve images bigger than a texture can be
     mMipmaps.clear();
-    if(img.isNull())
-    {
-    }
-    else
+    if(!img.isNull())
     {
         mMipmaps.append(img);
-        const int levels = logf(std::min(img.width(), img.height())) / logf(2.0);
-        for(int i = 1; i < levels; ++i)
+        for(int i = 0; i < mipmaps.count(); ++i)
         {
-            const QImage prevImg = mMipmaps.at(i - 1);
-            mMipmaps.append(prevImg.scaled(prevImg.size() / 2, Qt::KeepAspectRatio, Qt::FastTransformation));
+            const QImage level = mipmaps.at(i).value<QImage>();
+            if(level.size() != mMipmaps.last().size() / 2)
+                break;
+            mMipmaps.append(level);
         }
     }
-    updateCache();
+    mIsTextureDirty = true;
+    update();
+}
+
+void ImageElement::setMaxTextureSize(const int size)
+{
+    if(mMaxTextureSize != size)
+    {
+        mMaxTextureSize = size;
+        emit maxTextureSizeChanged();
+    }
+}
+
+QSGNode *ImageElement::updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *data)
+{
+    Q_UNUSED(data)
+
+    // the scene graph may not be OpenGL based, there is no limit to respect then
+    GLint maxTextureSize = std::numeric_limits<GLint>::max();
+    if(QOpenGLContext *context = QOpenGLContext::currentContext())
+    {
+        context->functions()->glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    }
+    // called on the render thread, the property belongs to the GUI one
+    if(maxTextureSize != mMaxTextureSize)
+    {
+        QMetaObject::invokeMethod(this, "setMaxTextureSize", Qt::QueuedConnection, Q_ARG(int, maxTextureSize));
+    }
+
+    ImageElementNode *node = static_cast<ImageElementNode*>(oldNode);
+    if(mMipmaps.isEmpty())
+    {
+        delete node;
+        return nullptr;
+    }
+
+    if(!node)
+    {
+        node = new ImageElementNode;
+        mIsTextureDirty = true;
+    }
+
+    if(mIsTextureDirty)
+    {
+        node->setTexture(window()->createTextureFromImage(getTextureImage(maxTextureSize)));
+        mIsTextureDirty = false;
+    }
+
+    node->setRect(calcTargetRect());
+    return node;
+}
+
+void ImageElement::geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry)
+{
+    QQuickItem::geometryChanged(newGeometry, oldGeometry);
     update();
 }
 
-void ImageElement::paint(QPainter *painter)
+QImage ImageElement::getTextureImage(const int maxTextureSize)const
 {
-    if(mCached.isNull())
-        return;
+    // the biggest level fitting into a texture, scaled here only when no provided level does
+    for(int i = 0; i < mMipmaps.count(); ++i)
+    {
+        const QImage img = mMipmaps.at(i);
+        if((img.width() <= maxTextureSize) && (img.height() <= maxTextureSize))
+            return img;
+    }
+    return mMipmaps.last().scaled(maxTextureSize, maxTextureSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+}
 
+QRectF ImageElement::calcTargetRect()const
+{
     const QSizeF curSize(width(), height());
-    const QSizeF sizeDiff = curSize - mCached.size();
+    const QSizeF imgSize = QSizeF(mMipmaps.first().size()).scaled(curSize, Qt::KeepAspectRatio);
+    const QSizeF sizeDiff = curSize - imgSize;
     const QPointF pos(mAlignment.testFlag(Qt::AlignLeft)
                       ? 0
                       : (mAlignment.testFlag(Qt::AlignRight)
@@ -71,29 +188,7 @@ void ImageElement::paint(QPainter *painter)
                       : (mAlignment.testFlag(Qt::AlignBottom)
                          ? sizeDiff.height()
                          : sizeDiff.height() / 2));
-    painter->drawImage(pos, mCached);
-}
-
-void ImageElement::geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry)
-{
-    QQuickPaintedItem::geometryChanged(newGeometry, oldGeometry);
-    updateCache();
-    update();
-}
-
-void ImageElement::updateCache()
-{
-    if(mMipmaps.isEmpty())
-    {
-        mCached = QImage();
-    }
-    else
-    {
-        const QSize curSize(width(), height());
-        const int level = logf(std::min(curSize.width(), curSize.height())) / logf(2.0);
-        const int index = qBound(0, mMipmaps.count() - level - 1, mMipmaps.count() - 1);
-        mCached = mMipmaps.at(index).scaled(curSize, Qt::KeepAspectRatio, Qt::FastTransformation);
-    }
+    return QRectF(pos, imgSize);
 }
 
 Qt::Alignment ImageElement::getAlignment()const
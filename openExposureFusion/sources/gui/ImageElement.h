@@ -22,10 +22,11 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <QtCore>
 #include <QtQuick>
 
-class ImageElement : public QQuickPaintedItem
+class ImageElement : public QQuickItem
 {
     Q_OBJECT
     Q_PROPERTY(QImage           img         READ getImage       WRITE setImage)
+    Q_PROPERTY(int              maxTextureSize  READ getMaxTextureSize  NOTIFY maxTextureSizeChanged)
     Q_PROPERTY(Qt::Alignment    alignment   READ getAlignment   WRITE setAlignment)
 
 public:
@@ -33,21 +34,31 @@ public:
     ~ImageElement();
 
     QImage getImage()const;
+    int getMaxTextureSize()const;
     Qt::Alignment getAlignment()const;
 
-    virtual void paint(QPainter *painter);
+    virtual QSGNode *updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *data);
     virtual void geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry);
 
 public slots:
     void setImage(const QImage img);
+    void setMipmappedImage(const QImage img, const QVariantList mipmaps);
     void setAlignment(const Qt::Alignment flags);
 
+signals:
+    void maxTextureSizeChanged();
+
+private slots:
+    void setMaxTextureSize(const int size);
+
 private:
     Qt::Alignment mAlignment;
-    QVector<QImage> mMipmaps;
-    QImage mCached;
+    QVector<QImage> mMipmaps;         // the image followed by its reduced levels, as many as were provided
+    int mMaxTextureSize;              // 0 until the first frame is rendered
+    bool mIsTextureDirty;
 
-    void updateCache();
+    QImage getTextureImage(const int maxTextureSize)const;
+    QRectF calcTargetRect()const;
 };
 
 #endif // IMAGEELEMENT_H
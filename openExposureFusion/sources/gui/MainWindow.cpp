@@ -29,6 +29,7 @@ const QMap<MainWindow::PropertyType /*type*/, QString/*qml name*/> kProperties =
     {MainWindow::PT_OutputFormatIndex,      "formatsIndex"},
     {MainWindow::PT_OutputDir,              "outputDir"},
     {MainWindow::PT_ResultImage,            "resultImg"},
+    {MainWindow::PT_ResultTextureLimit,     "resultTextureLimit"},
     {MainWindow::PT_Progress,               "progress"},
     {MainWindow::PT_DevicesModel,           "devicesModel"},
     {MainWindow::PT_DevicesIndex,           "devicesIndex"},
@@ -37,7 +38,8 @@ const QMap<MainWindow::PropertyType /*type*/, QString/*qml name*/> kProperties =
     {MainWindow::PT_DeviceWarningVisible,   "deviceWarningVisible"},
     {MainWindow::PT_StatusText,             "statusText"},
     {MainWindow::PT_MemoryText,             "memoryText"},
-    {MainWindow::PT_MemoryProgress,         "memoryProgress"}
+    {MainWindow::PT_MemoryProgress,         "memoryProgress"},
+    {MainWindow::PT_PerformanceModel,       "performanceModel"}
 };
 
 MainWindow::MainWindow(QObject *parent)
@@ -130,3 +132,13 @@ void MainWindow::appendDebugStr(const QString str)
 {
     QMetaObject::invokeMethod(mWindow, "appendDebugStr", Q_ARG(const QVariant, str));
 }
+
+void MainWindow::setResultImage(const QImage img, const QVector<QImage> mipmaps)
+{
+    QVariantList mipmapsList;
+    for(int i = 0; i < mipmaps.count(); ++i)
+    {
+        mipmapsList.append(mipmaps.at(i));
+    }
+    QMetaObject::invokeMethod(mWindow, "setResultImage", Q_ARG(const QVariant, img), Q_ARG(const QVariant, mipmapsList));
+}
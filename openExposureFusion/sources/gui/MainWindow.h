@@ -40,6 +40,7 @@ public:
         PT_OutputFormatIndex,
         PT_OutputDir,
         PT_ResultImage,
+        PT_ResultTextureLimit,
         PT_Progress,
         PT_DevicesModel,
         PT_DevicesIndex,
@@ -49,6 +50,7 @@ public:
         PT_StatusText,
         PT_MemoryText,
         PT_MemoryProgress,
+        PT_PerformanceModel,
         PT_max
     };
 
@@ -63,6 +65,7 @@ public slots:
     void setVisible(const bool visible);
     void resizeDevicesTable();
     void appendDebugStr(const QString str);
+    void setResultImage(const QImage img, const QVector<QImage> mipmaps);
 
 signals:
     void propertyChanged(const MainWindow::PropertyType type);
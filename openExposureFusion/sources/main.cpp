@@ -20,10 +20,17 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <QtGui>
 #include <QtWidgets>
 #include "MainController.h"
+#include "Validator.h"
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
+
+    // "--validate <image> ..." checks the device results against the reference instead of starting the UI
+    const QStringList args = a.arguments();
+    if(args.value(1) == "--validate")
+        return Validator::run(args.mid(2));
+
     MainController ctrl;
     const int retCode = ctrl.init() ? a.exec() : 0;
     ctrl.release();
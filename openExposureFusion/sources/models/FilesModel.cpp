@@ -17,6 +17,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "FilesModel.h"
+#include "ImageCache.h"
 #include <QtQml>
 #include <QtConcurrent/QtConcurrent>
 
@@ -24,13 +25,18 @@ const int kColumns = 2;
 
 FilesModel::FilesModel(QObject *parent)
     : QAbstractTableModel(parent)
-    , mIsLoaderRunning(false)
+    , mMaxLoaders(std::max(1, QThread::idealThreadCount()))
+    , mIsChanged(false)
 {
-    connect(&mFileLoadWatcher, SIGNAL(finished()), SLOT(onFileLoadWatcherFinished()));
 }
 
 FilesModel::~FilesModel()
 {
+    for(int i = 0; i < mFileLoadWatchers.count(); ++i)
+    {
+        mFileLoadWatchers.at(i)->waitForFinished();
+    }
+    qDeleteAll(mFileLoadWatchers);
 }
 
 int FilesModel::rowCount(const QModelIndex &) const
@@ -49,10 +55,10 @@ QVariant FilesModel::data(const QModelIndex &index, int role) const
     if(!index.isValid())
         return QVariant();
 
-    const FileInfo file(mFiles.at(index.row()));
+    const FileInfo &file = mFiles.at(index.row());
     switch (role)
     {
-        case R_Thumbnail:   return file.getImage();
+        case R_Thumbnail:   return file.getThumbnail();
         case R_FilePath:    return file.getFilePath();
     }
     return QVariant();
@@ -176,24 +182,32 @@ bool FilesModel::isEmpty()const
 
 void FilesModel::processNext()
 {
-    if(mFilesQueue.isEmpty())
-        return;
-    if(mIsLoaderRunning)
-        return;
-
-    const auto iter = mFilesQueue.begin();
-    const QString file = iter.key();
-    const bool doAdd = iter.value();
-    mFilesQueue.erase(iter);
+    // additions decode in parallel up to mMaxLoaders files,
+    // a removal waits for all of them to land so it can't miss a file that is still loading
+    while(!mFilesQueue.isEmpty())
+    {
+        const auto iter = mFilesQueue.begin();
+        const QString file = iter.key();
+        const bool doAdd = iter.value();
+        if(doAdd ? (mFileLoadWatchers.count() >= mMaxLoaders) : !mFileLoadWatchers.isEmpty())
+            return;
 
-    doAdd ? add(file) : remove(file);
+        mFilesQueue.erase(iter);
+        doAdd ? add(file) : remove(file);
+    }
 
-    if(!mFilesQueue.isEmpty())
-        QMetaObject::invokeMethod(this, "processNext", Qt::QueuedConnection);
+    // the batch is done once nothing is queued or loading, listeners get a single notification for it
+    if(mIsChanged && mFileLoadWatchers.isEmpty())
+    {
+        mIsChanged = false;
+        emit filesChanged();
+    }
 }
 
 void FilesModel::add(const QString path)
 {
+    if(mLoadingFiles.contains(path))
+        return;
     for(int i = 0; i < mFiles.count(); ++i)
     {
         if(mFiles.at(i).getFilePath() == path)
@@ -201,8 +215,11 @@ void FilesModel::add(const QString path)
     }
 
     static const auto loader = [](const QString path){ return FileInfo(path); };
-    mFileLoadWatcher.setFuture(QtConcurrent::run(loader, path));
-    mIsLoaderRunning = true;
+    QFutureWatcher<FileInfo> *watcher = new QFutureWatcher<FileInfo>(this);
+    connect(watcher, SIGNAL(finished()), SLOT(onFileLoadWatcherFinished()));
+    watcher->setFuture(QtConcurrent::run(loader, path));
+    mFileLoadWatchers.append(watcher);
+    mLoadingFiles.append(path);
 }
 
 void FilesModel::remove(const QString path)
@@ -223,19 +240,33 @@ void FilesModel::remove(const QString path)
     beginRemoveRows(QModelIndex(), index, index);
     mFiles.removeAt(index);
     endRemoveRows();
+    ImageCache::remove(path);
+    mIsChanged = true;
 
     emit emptyChanged();
 }
 
 void FilesModel::onFileLoadWatcherFinished()
 {
-    mIsLoaderRunning = false;
-    const FileInfo file = mFileLoadWatcher.result();
-    if(file.isValid())
+    // files are inserted in submission order, so only the finished head of the list is taken,
+    // a file decoded ahead of its predecessors waits for them
+    QList<FileInfo> loaded;
+    while(!mFileLoadWatchers.isEmpty() && mFileLoadWatchers.first()->isFinished())
+    {
+        QFutureWatcher<FileInfo> *watcher = mFileLoadWatchers.takeFirst();
+        mLoadingFiles.removeFirst();
+        const FileInfo file = watcher->result();
+        if(file.isValid())
+            loaded.append(file);
+        watcher->deleteLater();
+    }
+
+    if(!loaded.isEmpty())
     {
-        beginInsertRows(QModelIndex(), mFiles.count(), mFiles.count());
-        mFiles.append(file);
+        beginInsertRows(QModelIndex(), mFiles.count(), mFiles.count() + loaded.count() - 1);
+        mFiles.append(loaded);
         endInsertRows();
+        mIsChanged = true;
         emit emptyChanged();
     }
     QMetaObject::invokeMethod(this, "processNext", Qt::QueuedConnection);
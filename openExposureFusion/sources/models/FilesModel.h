@@ -56,6 +56,7 @@ public slots:
 
 signals:
     void emptyChanged();
+    void filesChanged(); // once per batch of additions and removals, when all of its files are decoded
 
 private slots:
     void processNext();
@@ -64,8 +65,10 @@ private slots:
 private:
     QList<FileInfo> mFiles;
     QMap<QString, bool/*true = add; false = remove*/> mFilesQueue;
-    QFutureWatcher<FileInfo> mFileLoadWatcher;
-    bool mIsLoaderRunning;
+    QList<QFutureWatcher<FileInfo>*> mFileLoadWatchers; // in submission order
+    QStringList mLoadingFiles;                          // paths of mFileLoadWatchers
+    int mMaxLoaders;
+    bool mIsChanged; // rows changed since the last filesChanged()
 
     void add(const QString path);
     void remove(const QString path);
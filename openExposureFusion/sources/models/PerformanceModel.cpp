@@ -0,0 +1,201 @@
+/*
+openExposureFusion
+Copyright (C) 2015 Alexey Markarov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PerformanceModel.h"
+#include "Util.h"
+
+const int PerformanceModel::kHistorySize = 50;
+
+PerformanceModel::PerformanceModel()
+{
+}
+
+PerformanceModel::~PerformanceModel()
+{
+}
+
+int PerformanceModel::rowCount(const QModelIndex &) const
+{
+    return RW_max;
+}
+
+int PerformanceModel::columnCount(const QModelIndex &) const
+{
+    return R_max;
+}
+
+QVariant PerformanceModel::data(const QModelIndex &index, int role) const
+{
+    if(!index.isValid())
+        return QVariant();
+
+    const QMap<MertensCl::Strategy, QString> strategies = {
+        {MertensCl::S_Incremental,  tr("incremental")},
+        {MertensCl::S_Resident,     tr("all frames resident")},
+        {MertensCl::S_Streaming,    tr("streaming frames")},
+        {MertensCl::S_Tiled,        tr("tiled")}
+    };
+    const QStringList stages = {tr("Upload"), tr("Weights"), tr("Pyramids"), tr("Blend"), tr("Collapse"), tr("Readback")};
+    const QString msecs = tr("%1 ms");
+
+    const int row = index.row();
+    if(row >= RW_StageFirst && row < RW_Dispatches)
+    {
+        switch(role)
+        {
+            case R_Name:    return stages.value(row - RW_StageFirst);
+            case R_Value:   return msecs.arg(mLast.stageMsecs.value(row - RW_StageFirst), 0, 'f', 2);
+        }
+        return QVariant();
+    }
+
+    switch(row)
+    {
+        case RW_Strategy:
+            switch(role)
+            {
+                case R_Name:    return tr("Strategy");
+                case R_Value:   return strategies.value(mLast.strategy);
+            }
+            break;
+
+        case RW_Total:
+            switch(role)
+            {
+                case R_Name:    return tr("Total");
+                case R_Value:   return msecs.arg(mLast.hostMsecs, 0, 'f', 2);
+            }
+            break;
+
+        case RW_Dispatches:
+            switch(role)
+            {
+                case R_Name:    return tr("Dispatches");
+                case R_Value:   return QString::number(mLast.dispatches);
+            }
+            break;
+
+        case RW_DeviceMemory:
+            switch(role)
+            {
+                case R_Name:    return tr("Device memory");
+                case R_Value:   return tr("%1, peak %2")
+                            .arg(Util::toHumanText(mLast.deviceBytes))
+                            .arg(Util::toHumanText(mLast.peakDeviceBytes));
+            }
+            break;
+
+        case RW_Upload:
+            switch(role)
+            {
+                case R_Name:    return tr("Upload");
+                case R_Value:   return toRate(mLast.uploadBytes, mLast.uploadMsecs);
+            }
+            break;
+
+        case RW_Readback:
+            switch(role)
+            {
+                case R_Name:    return tr("Readback");
+                case R_Value:   return toRate(mLast.readbackBytes, mLast.readbackMsecs);
+            }
+            break;
+
+        case RW_Pruned:
+            switch(role)
+            {
+                case R_Name:    return tr("Pruned frames");
+                case R_Value:   return prunedText(mLast);
+            }
+            break;
+
+        case RW_BlendTiles:
+            switch(role)
+            {
+                case R_Name:    return tr("Blended tiles");
+                case R_Value:   return (mLast.blendTiles > 0)
+                            ? tr("%1 of %2, %3%")
+                              .arg(mLast.blendedTiles)
+                              .arg(mLast.blendTiles)
+                              .arg(100.0 * mLast.blendedTiles / mLast.blendTiles, 0, 'f', 1)
+                            : tr("none");
+            }
+            break;
+    }
+    return QVariant();
+}
+
+QHash<int, QByteArray> PerformanceModel::roleNames() const
+{
+    static const QHash<int, QByteArray> roles = {
+        {R_Name,    "propertyname"},
+        {R_Value,   "propertyvalue"}
+    };
+    return roles;
+}
+
+QVariantList PerformanceModel::getHistory()const
+{
+    return mHistory;
+}
+
+void PerformanceModel::addRun(const MertensCl::Statistics statistics)
+{
+    mLast = statistics;
+    emit dataChanged(index(0, 0), index(rowCount() - 1, columnCount() - 1));
+
+    mHistory.append(statistics.hostMsecs);
+    while(mHistory.count() > kHistorySize)
+        mHistory.removeFirst();
+    emit historyChanged();
+}
+
+QString PerformanceModel::prunedText(const MertensCl::Statistics &statistics)
+{
+    // the frame with the lowest max is the first one a higher threshold would prune
+    QString weakest;
+    if(!statistics.weightMax.isEmpty())
+    {
+        int frame = 0;
+        for(int i = 1; i < statistics.weightMax.count(); ++i)
+        {
+            if(statistics.weightMax.at(i) < statistics.weightMax.at(frame))
+                frame = i;
+        }
+        weakest = tr(", weakest weight max %1 mean %2")
+                .arg(statistics.weightMax.at(frame), 0, 'g', 3)
+                .arg(statistics.weightMean.at(frame), 0, 'g', 3);
+    }
+
+    if(statistics.prunedFiles.isEmpty())
+        return tr("none of %1").arg(statistics.frames) + weakest;
+
+    QStringList names;
+    for(int i = 0; i < statistics.prunedFiles.count(); ++i)
+    {
+        names.append(QFileInfo(statistics.prunedFiles.at(i)).fileName());
+    }
+    return tr("%1 of %2: %3").arg(names.count()).arg(statistics.frames).arg(names.join(", ")) + weakest;
+}
+
+QString PerformanceModel::toRate(const qint64 bytes, const double msecs)
+{
+    if(bytes <= 0 || msecs <= 0)
+        return Util::toHumanText(bytes);
+    return tr("%1 at %2 GB/s").arg(Util::toHumanText(bytes)).arg(bytes / (msecs * 1e6), 0, 'f', 2);
+}
@@ -0,0 +1,76 @@
+/*
+openExposureFusion
+Copyright (C) 2015 Alexey Markarov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PERFORMANCEMODEL_H
+#define PERFORMANCEMODEL_H
+
+#include <QtCore>
+#include "MertensCl.h"
+
+class PerformanceModel : public QAbstractTableModel
+{
+    Q_OBJECT
+    Q_PROPERTY(QVariantList history READ getHistory NOTIFY historyChanged)
+
+public:
+    enum Role {
+        R_Name = 0,
+        R_Value,
+        R_max
+    };
+
+    PerformanceModel();
+    ~PerformanceModel();
+
+    virtual int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    virtual int columnCount(const QModelIndex &parent = QModelIndex()) const;
+    virtual QVariant data(const QModelIndex &index, int role) const;
+    virtual QHash<int, QByteArray> roleNames() const;
+
+    QVariantList getHistory()const;
+
+public slots:
+    void addRun(const MertensCl::Statistics statistics);
+
+signals:
+    void historyChanged();
+
+private:
+    enum Row {
+        RW_Strategy = 0,
+        RW_Total,
+        RW_StageFirst,
+        RW_Dispatches = RW_StageFirst + MertensCl::ST_max,
+        RW_DeviceMemory,
+        RW_Upload,
+        RW_Readback,
+        RW_Pruned,
+        RW_BlendTiles,
+        RW_max
+    };
+
+    static const int kHistorySize;
+
+    MertensCl::Statistics mLast;
+    QVariantList mHistory;  // total run times, oldest first
+
+    static QString toRate(const qint64 bytes, const double msecs);
+    static QString prunedText(const MertensCl::Statistics &statistics);
+};
+
+#endif // PERFORMANCEMODEL_H
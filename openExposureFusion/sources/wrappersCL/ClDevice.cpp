@@ -45,6 +45,7 @@ QDebug operator<<(QDebug dbg, const ClDevice &dev)
                   << "\n\tname\t= "             << dev.getName()
                   << "\n\tbits\t= "             << dev.getBits()
                   << "\n\tmemory\t= "           << dev.getGlobalMemory() << " " << Util::toHumanText(dev.getGlobalMemory())
+                  << "\n\tmax alloc\t= "        << dev.getMaxMemAllocSize() << " " << Util::toHumanText(dev.getMaxMemAllocSize())
                   << "\n\tlocal memory\t= "     << dev.getLocalMemSize() << " " << Util::toHumanText(dev.getLocalMemSize())
                   << "\n\tavailable\t= "        << dev.isAvailable()
                   << "\n\tcompiler\t= "         << dev.isCompilerAvailable()
@@ -96,6 +97,16 @@ cl_ulong ClDevice::getDeviceGlobalMemory(const cl_device_id id)
     return size;
 }
 
+cl_ulong ClDevice::getDeviceMaxMemAllocSize(const cl_device_id id)
+{
+    if(!id)
+        return 0;
+
+    cl_ulong size = 0;
+    clGetDeviceInfo(id, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &size, 0);
+    return size;
+}
+
 cl_bool ClDevice::isDeviceAvailable(const cl_device_id id)
 {
     if(!id)
@@ -248,11 +259,23 @@ cl_ulong ClDevice::getDeviceLocalMemSize(const cl_device_id id)
             : 0;
 }
 
+cl_command_queue_properties ClDevice::getDeviceQueueProperties(const cl_device_id id)
+{
+    if(!id)
+        return 0;
+
+    cl_command_queue_properties properties = 0;
+    return clGetDeviceInfo(id, CL_DEVICE_QUEUE_PROPERTIES, sizeof(properties), &properties, nullptr) == CL_SUCCESS
+            ? properties
+            : 0;
+}
+
 ClDevice::ClDevice(const cl_device_id id)
     : mId(id),
       mName(getDeviceName(id)),
       mBits(getDeviceBits(id)),
       mGlobalMemory(getDeviceGlobalMemory(id)),
+      mMaxMemAllocSize(getDeviceMaxMemAllocSize(id)),
       mIsAvailable(isDeviceAvailable(id)),
       mIsCompilerAvailable(isDeviceCompilerAvailable(id)),
       mImageSize(getDeviceImageSize(id)),
@@ -286,6 +309,7 @@ ClDevice &ClDevice::operator=(const ClDevice &device)
         mName                   = device.mName;
         mBits                   = device.mBits;
         mGlobalMemory           = device.mGlobalMemory;
+        mMaxMemAllocSize        = device.mMaxMemAllocSize;
         mIsAvailable            = device.mIsAvailable;
         mIsCompilerAvailable    = device.mIsCompilerAvailable;
         mImageSize              = device.mImageSize;
@@ -333,6 +357,11 @@ cl_ulong ClDevice::getGlobalMemory()const
     return mGlobalMemory;
 }
 
+cl_ulong ClDevice::getMaxMemAllocSize()const
+{
+    return mMaxMemAllocSize;
+}
+
 cl_bool ClDevice::isAvailable()const
 {
     return mIsAvailable;
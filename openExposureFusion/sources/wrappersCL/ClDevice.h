@@ -28,6 +28,7 @@ public:
     static QString                  getDeviceName(const cl_device_id id);
     static cl_uint                  getDeviceBits(const cl_device_id id);
     static cl_ulong                 getDeviceGlobalMemory(const cl_device_id id);
+    static cl_ulong                 getDeviceMaxMemAllocSize(const cl_device_id id);
     static cl_bool                  isDeviceAvailable(const cl_device_id id);
     static cl_bool                  isDeviceCompilerAvailable(const cl_device_id id);
     static QSize                    getDeviceImageSize(const cl_device_id id);
@@ -39,6 +40,7 @@ public:
     static size_t                   getDeviceMaxWorkGroupSize(const cl_device_id id);
     static QVector<size_t>          getDeviceMaxWorkItemSizes(const cl_device_id id);
     static cl_ulong                 getDeviceLocalMemSize(const cl_device_id id);
+    static cl_command_queue_properties getDeviceQueueProperties(const cl_device_id id);
 
     ClDevice(const cl_device_id id);
     ClDevice(const ClDevice &device);
@@ -49,6 +51,7 @@ public:
     QString                     getName()const;
     cl_uint                     getBits()const;
     cl_ulong                    getGlobalMemory()const;
+    cl_ulong                    getMaxMemAllocSize()const;
     cl_bool                     isAvailable()const;
     cl_bool                     isCompilerAvailable()const;
     QSize                       getImageSize()const;
@@ -66,6 +69,7 @@ private:
     QString                     mName;
     cl_uint                     mBits;
     cl_ulong                    mGlobalMemory;
+    cl_ulong                    mMaxMemAllocSize;
     cl_bool                     mIsAvailable;
     cl_bool                     mIsCompilerAvailable;
     QSize                       mImageSize;
@@ -0,0 +1,131 @@
+/*
+openExposureFusion
+Copyright (C) 2015 Alexey Markarov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ClMemory.h"
+#include "Util.h"
+#include "Logger.h"
+
+QMutex ClMemory::sMutex;
+QHash<cl_mem, ClMemory::Allocation> ClMemory::sAllocations;
+QVector<qint64> ClMemory::sBytes(ClMemory::MC_max, 0);
+qint64 ClMemory::sTotalBytes = 0;
+qint64 ClMemory::sPeakBytes = 0;
+
+cl_mem ClMemory::createBuffer(const cl_context context, const cl_mem_flags flags, const size_t bytes,
+                              const Category category, cl_int *error)
+{
+    const cl_mem mem = clCreateBuffer(context, flags, bytes, nullptr, error);
+    if(mem && (!error || (*error == CL_SUCCESS)))
+    {
+        track(mem, Allocation(category, {0, 0}, QSize(static_cast<int>(bytes), 1), bytes));
+    }
+    return mem;
+}
+
+cl_mem ClMemory::createImage2D(const cl_context context, const cl_mem_flags flags, const cl_image_format format,
+                               const QSize size, const Category category, cl_int *error)
+{
+    const cl_mem mem = clCreateImage2D(context, flags, &format, size.width(), size.height(), 0, nullptr, error);
+    if(mem && (!error || (*error == CL_SUCCESS)))
+    {
+        track(mem, Allocation(category, format, size, Util::byteCount(size, format)));
+    }
+    return mem;
+}
+
+void ClMemory::release(const cl_mem mem)
+{
+    if(!mem)
+        return;
+
+    {
+        QMutexLocker lock(&sMutex);
+        const Allocation allocation = sAllocations.take(mem);
+        if(allocation.category != MC_max)
+        {
+            sBytes[allocation.category] -= allocation.bytes;
+            sTotalBytes -= allocation.bytes;
+        }
+    }
+    clReleaseMemObject(mem);
+}
+
+void ClMemory::release(const QVector<cl_mem> mems)
+{
+    for(int i = 0; i < mems.count(); ++i)
+    {
+        release(mems.at(i));
+    }
+}
+
+qint64 ClMemory::getBytes()
+{
+    QMutexLocker lock(&sMutex);
+    return sTotalBytes;
+}
+
+QVector<qint64> ClMemory::getBytesPerCategory()
+{
+    QMutexLocker lock(&sMutex);
+    return sBytes;
+}
+
+qint64 ClMemory::getPeakBytes()
+{
+    QMutexLocker lock(&sMutex);
+    return sPeakBytes;
+}
+
+void ClMemory::resetPeak()
+{
+    QMutexLocker lock(&sMutex);
+    sPeakBytes = sTotalBytes;
+}
+
+QString ClMemory::toString(const Category category)
+{
+    static const QMap<Category, QString> map = {
+        {MC_Staging,        "staging"},
+        {MC_Frame,          "frames"},
+        {MC_Weight,         "weights"},
+        {MC_FramePyramid,   "frame pyramids"},
+        {MC_Processing,     "temporaries"},
+        {MC_Pyramid,        "pyramids"}
+    };
+    return map.value(category, QObject::tr("undefined"));
+}
+
+void ClMemory::track(const cl_mem mem, const Allocation allocation)
+{
+    // the driver's size includes its row padding, the computed one is used when it doesn't tell
+    Allocation tracked = allocation;
+    size_t bytes = 0;
+    if((clGetMemObjectInfo(mem, CL_MEM_SIZE, sizeof(size_t), &bytes, nullptr) == CL_SUCCESS) && (bytes > 0))
+    {
+        tracked.bytes = bytes;
+    }
+
+    verboseDebug() << "allocated" << toString(tracked.category) << Util::toString(tracked.format)
+                   << tracked.size << tracked.bytes;
+
+    QMutexLocker lock(&sMutex);
+    sAllocations.insert(mem, tracked);
+    sBytes[tracked.category] += tracked.bytes;
+    sTotalBytes += tracked.bytes;
+    sPeakBytes = std::max(sPeakBytes, sTotalBytes);
+}
@@ -0,0 +1,80 @@
+/*
+openExposureFusion
+Copyright (C) 2015 Alexey Markarov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CLMEMORY_H
+#define CLMEMORY_H
+
+#include <QtCore>
+#include "clew/clew.h"
+
+// creates and releases memory objects and keeps account of the live ones
+class ClMemory
+{
+public:
+    enum Category
+    {
+        MC_Staging = 0,     // host rows on their way into the frames
+        MC_Frame,           // imported frames
+        MC_Weight,          // weight map of every frame
+        MC_FramePyramid,    // laplacian pyramid of every frame
+        MC_Processing,      // per pass temporaries, the result included
+        MC_Pyramid,         // pyramid atlases of a pass
+        MC_max
+    };
+
+    static cl_mem createBuffer(const cl_context context, const cl_mem_flags flags, const size_t bytes,
+                               const Category category, cl_int *error);
+    static cl_mem createImage2D(const cl_context context, const cl_mem_flags flags, const cl_image_format format,
+                                const QSize size, const Category category, cl_int *error);
+    static void release(const cl_mem mem);
+    static void release(const QVector<cl_mem> mems);
+
+    static qint64 getBytes();
+    static QVector<qint64> getBytesPerCategory();
+    static qint64 getPeakBytes();
+    static void resetPeak();
+    static QString toString(const Category category);
+
+private:
+    class Allocation
+    {
+    public:
+        Category category;
+        cl_image_format format; // zeros for buffers
+        QSize size;             // buffers are a row of bytes
+        qint64 bytes;           // as reported by the driver, padding included
+
+        Allocation(const Category c = MC_max, const cl_image_format f = {0, 0}, const QSize s = QSize(),
+                   const qint64 b = 0)
+            : category(c), format(f), size(s), bytes(b)
+        { }
+    };
+
+    static QMutex sMutex;
+    static QHash<cl_mem, Allocation> sAllocations;
+    static QVector<qint64> sBytes;  // live bytes of every Category
+    static qint64 sTotalBytes;
+    static qint64 sPeakBytes;
+
+    static void track(const cl_mem mem, const Allocation allocation);
+
+    ClMemory();
+    ~ClMemory();
+};
+
+#endif // CLMEMORY_H